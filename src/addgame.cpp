@@ -66,6 +66,11 @@ void AddGame::runTask()
                 }
                 continue;
             }
+
+            if (fieldName == "Material") {
+                create_materialColumn = true;
+                continue;
+            }
             
             if (idSet.find(fieldName) != idSet.end()) {
                 fieldName = fieldName.substr(0, fieldName.size() - 2);
@@ -75,6 +80,9 @@ void AddGame::runTask()
         }
 
         setupTagVec(tagVec, paraRecord.optionFlag);
+
+        create_positionTable = (paraRecord.optionFlag & (create_flag_moves1 | create_flag_moves2)) && mDb->tableExists("Positions");
+        create_similarTable = (paraRecord.optionFlag & (create_flag_moves1 | create_flag_moves2)) && mDb->tableExists("SimilarPositions");
     }
     {
         SQLite::Statement stmtGID(*mDb, "SELECT max(ID) FROM Games");
@@ -277,7 +285,7 @@ void AddGame::addAGame(const bslib::PgnRecord& record, const std::vector<int8_t>
         }
     }
     
-    t->board->newGame(record.fenText);
+    t->board->_newGame(record.fenText);
 
     // Parse moves
     if (paraRecord.optionFlag & (create_flag_moves1 | create_flag_moves2)) {
@@ -288,10 +296,14 @@ void AddGame::addAGame(const bslib::PgnRecord& record, const std::vector<int8_t>
             flag |= bslib::BoardCore::ParseMoveListFlag_discardComment;
         }
 
+        if (ecoString.empty() || (paraRecord.optionFlag & create_flag_reset_eco)) {
+            flag |= bslib::BoardCore::ParseMoveListFlag_eco;
+        }
+
 //        bslib::PgnRecord record;
 //        record.moveText = moveText;
 //        record.gameID = gameID;
-        t->board->fromMoveList(&record, bslib::Notation::san, flag);
+        t->board->_fromMoveList(&record, bslib::Notation::san, flag, nullptr);
 
         plyCount = t->board->getHistListSize();
 
@@ -372,6 +384,16 @@ void AddGame::addAGame(const bslib::PgnRecord& record, const std::vector<int8_t>
     for(auto && it : intMap) {
         t->insertGameStatement->bind(":" + it.first, it.second);
     }
+
+    if (create_materialColumn && (paraRecord.optionFlag & (create_flag_moves1 | create_flag_moves2))) {
+        t->insertGameStatement->bind(":Material", static_cast<long long>(t->board->_getMaterialSignature()));
+    }
+    if (create_positionTable) {
+        insertPositions(t, gameID);
+    }
+    if (create_similarTable) {
+        insertSimilarPositions(t, gameID);
+    }
     
     t->insertGameStatement->exec();
 
@@ -389,6 +411,12 @@ bool AddGameDbRead::openDB(const std::string& dbPath)
     return DbRead::openDB(dbPath) && addGameInstance->createConvertingIDMaps(mDb);
 }
 
+void AddGameDbRead::printStats() const
+{
+    DbRead::printStats();
+    std::cout << std::endl;
+}
+
 
 void AddGameDbRead::processAGame(const bslib::PgnRecord& record, const std::vector<int8_t>& moveVec)
 {
@@ -29,6 +29,7 @@ public:
 
 private:
     virtual bool openDB(const std::string& dbPath) override;
+    virtual void printStats() const override;
     
 };
 
@@ -37,7 +37,7 @@ std::string BoardCore::getStartingFen() const
 
 std::string BoardCore::getFen(bool enpassantLegal) const
 {
-    auto k = std::max<int>(fullMoveCnt, (histList.size() + 1) / 2);
+    auto k = std::max<int>(fullMoveCnt, (getHistListSize() + 1) / 2);
     return getFen(enpassantLegal, quietCnt / 2, k);
 }
 
@@ -52,7 +52,7 @@ std::string BoardCore::getEPD(bool enpassantLegal, bool withRecords, const Hist&
     auto str = getFen(enpassantLegal, -1, -1);
 
     if (withRecords) {
-        auto k = std::max<int>(fullMoveCnt, (histList.size() + 1) / 2);
+        auto k = std::max<int>(fullMoveCnt, (getHistListSize() + 1) / 2);
 
         // hmvc halfmove clock, fmvn fullmove number
         str += " hmvc " + std::to_string(quietCnt / 2) + "; fmvn " + std::to_string(k) + ";";
@@ -132,6 +132,10 @@ void BoardCore::newGame(std::string fen)
 void BoardCore::_newGame(std::string fen)
 {
     histList.clear();
+    histCompactList.clear();
+    histCompactMode = false;
+    ecoTracking = false;
+    ecoString.clear();
     firstComment.clear();
     _setFen(fen);
     result.reset();
@@ -181,14 +185,14 @@ bool BoardCore::equalMoveLists(const BoardCore* oBoard, bool embeded) const
 {
     assert(oBoard && startFen == oBoard->startFen);
 
-    auto n0 = histList.size(), n1 = oBoard->histList.size();
+    auto n0 = getHistListSize(), n1 = oBoard->getHistListSize();
     if (n0 != n1 && !embeded) {
         return false;
     }
 
     auto n = std::min(n0, n1);
-    for(size_t i = 0; i < n; ++i) {
-        if (histList.at(i).move != oBoard->histList.at(i).move) {
+    for(int i = 0; i < n; ++i) {
+        if (_getMoveAt(i) != oBoard->_getMoveAt(i)) {
             return false;
         }
     }
@@ -291,6 +295,35 @@ void BoardCore::_genLegal(std::vector<MoveFull>& moves, Side side, int from, int
     }
 }
 
+/// Count all legal move sequences of a given depth, for validating the move generator
+uint64_t BoardCore::_perft(int depth)
+{
+    if (depth <= 0) {
+        return 1;
+    }
+
+    std::vector<MoveFull> moveList;
+    _gen(moveList, side);
+
+    uint64_t nodes = 0;
+    HistCompact hist;
+
+    for (auto && move : moveList) {
+        _make(move, hist);
+        if (!_isIncheck(side)) {
+            if (depth > 1) {
+                side = xSide(side);
+                nodes += _perft(depth - 1);
+                side = xSide(side);
+            } else {
+                nodes++;
+            }
+        }
+        _takeBack(hist);
+    }
+    return nodes;
+}
+
 bool BoardCore::checkMake(int from, int dest, int promotion)
 {
     std::lock_guard<std::mutex> dolock(dataMutex);
@@ -339,9 +372,15 @@ void BoardCore::takeBack(const Hist& hist)
 
 void BoardCore::_make(const MoveFull& move)
 {
-    Hist hist;
-    _make(move, hist);
-    histList.push_back(hist);
+    if (histCompactMode) {
+        HistCompact hist;
+        _make(move, hist);
+        histCompactList.push_back(hist);
+    } else {
+        Hist hist;
+        _make(move, hist);
+        histList.push_back(hist);
+    }
     side = xSide(side);
     
     hashKey ^= xorSideHashKey();
@@ -351,6 +390,17 @@ void BoardCore::_make(const MoveFull& move)
 
 void BoardCore::_takeBack()
 {
+    if (histCompactMode) {
+        if (!histCompactList.empty()) {
+            auto hist = histCompactList.back();
+            histCompactList.pop_back();
+            _takeBack(hist);
+            side = xSide(side);
+            assert(_isHashKeyValid());
+        }
+        return;
+    }
+
     if (!histList.empty()) {
         auto hist = histList.back();
         histList.pop_back();
@@ -704,10 +754,19 @@ void BoardCore::_parseComment_standard(const std::string& comment, Hist& hist)
 bool BoardCore::fromMoveList(const PgnRecord* record,
                              Notation notation,
                              int flag,
-                             std::function<bool(const std::vector<uint64_t>&, const BoardCore*, const PgnRecord*)> shouldStop)
+                             std::function<bool(const PositionBB&, const BoardCore*, const PgnRecord*)> shouldStop)
 {
-    assert(record);
     std::lock_guard<std::mutex> dolock(dataMutex);
+    if (shouldStop) {
+        return _fromMoveList(record, notation, flag, shouldStop);
+    }
+    return _fromMoveList(record, notation, flag, nullptr);
+}
+
+// Split a move text into move strings and comments (indexed by the number of moves before them)
+void BoardCore::_parseMoveText(const PgnRecord* record, int flag, std::vector<std::string>& moveStringVec, std::map<size_t, std::string>& commentMap) const
+{
+    assert(record);
 
     enum class State {
         none, move, comment, commentRestOfLine, evalsym, variant, counter
@@ -715,8 +774,6 @@ bool BoardCore::fromMoveList(const PgnRecord* record,
     
     auto st = State::none;
         
-    std::vector<std::string> moveStringVec;
-    std::map<size_t, std::string> commentMap;
     std::map<size_t, std::string> eSymMap;
 
     std::string moveString, comment, esym;
@@ -858,109 +915,6 @@ bool BoardCore::fromMoveList(const PgnRecord* record,
     if (!comment.empty()) {
         commentMap[moveStringVec.size()] = comment;
     }
-
-    std::string fenString;
-    std::vector<uint64_t> bitboardVec;
-    
-    auto hit = false;
-    for(size_t i = 0; i < moveStringVec.size(); i++) {
-        auto ss = moveStringVec.at(i);
-
-        Move move;
-
-        if (notation == Notation::san) {
-            move = moveFromString_san(ss);
-        } else {
-            move = moveFromString_coordinate(ss);
-        }
-
-        if (move == Move::illegalMove) {
-            return false;
-        }
-        
-        /// Parse comment before making move for parsing pv
-        auto hasComment = false;
-        
-        Hist tmphist;
-        if (!commentMap.empty()) {
-            auto it = commentMap.find(i + 1);
-            if (it != commentMap.end()) {
-                if (flag & ParseMoveListFlag_parseComment) {
-                    _parseComment(it->second, tmphist);
-                } else {
-                    if (!tmphist.comment.empty()) {
-                        tmphist.comment += ", ";
-                    }
-                    tmphist.comment += it->second;
-                }
-                hasComment = true;
-            }
-        }
-
-        if (flag & ParseMoveListFlag_create_fen) {
-            fenString = getFen();
-        }
-        if (flag & ParseMoveListFlag_create_bitboard) {
-            bitboardVec = posToBitboards();
-            assert(!bitboardVec.empty());
-
-            if (shouldStop && shouldStop(bitboardVec, this, record)) {
-                hit = true;
-                break;
-            }
-        }
-
-        if (flag & ParseMoveListFlag_quick_check) {
-            if (!_quickCheckMake(move.from, move.dest, move.promotion, false)) {
-                return false;
-            }
-        } else {
-            if (!_checkMake(move.from, move.dest, move.promotion)) {
-                return false;
-            }
-        }
-        
-        assert(!histList.empty());
-        if (hasComment) {
-            histList.back().comment = tmphist.comment;
-            histList.back().esVec = tmphist.esVec;
-        }
-        
-        if (flag & ParseMoveListFlag_create_fen) {
-            histList.back().fenString = fenString;
-        }
-        
-        if (flag & ParseMoveListFlag_create_bitboard) {
-            histList.back().bitboardVec = bitboardVec;
-        }
-        
-        if (flag & ParseMoveListFlag_create_san) {
-            if (notation == Notation::san) {
-                histList.back().sanString = ss;
-            } else {
-                // missing function
-            }
-        }
-    }
-
-    // first comments
-    {
-        firstComment.clear();
-        auto it = commentMap.find(0);
-        if (it != commentMap.end()) {
-            firstComment = it->second;
-        }
-    }
-
-    // last position
-    if (shouldStop && !hit) {
-        bitboardVec = posToBitboards();
-        if (shouldStop(bitboardVec, this, record)) {
-            hit = true;
-        }
-    }
-
-    return true;
 }
 
 bool BoardCore::_quickCheck_rook(int from, int dest, bool checkMiddle) const
@@ -1001,77 +955,16 @@ bool BoardCore::_quickCheck_rook(int from, int dest, bool checkMiddle) const
 bool BoardCore::fromMoveList(const PgnRecord* record,
                              const std::vector<int8_t>& moveVec,
                              int flag,
-                             std::function<bool(const std::vector<uint64_t>& bitboardVec, const BoardCore*, const PgnRecord*)> shouldStop)
+                             std::function<bool(const PositionBB&, const BoardCore*, const PgnRecord*)> shouldStop)
 {
     std::lock_guard<std::mutex> dolock(dataMutex);
-    
-    std::string fenString;
-    std::vector<uint64_t> bitboardVec;
-    
-    auto hit = false;
-
-    for(size_t i = 0; i < moveVec.size();) {
-        if (flag & ParseMoveListFlag_create_fen) {
-            fenString = getFen();
-        }
-
-        if (flag & ParseMoveListFlag_create_bitboard) {
-            bitboardVec = posToBitboards();
-            assert(!bitboardVec.empty());
-
-            if (shouldStop && shouldStop(bitboardVec, this, record)) {
-                hit = true;
-                break;
-            }
-        }
-        
-        Move move;
-        
-        if (flag & ParseMoveListFlag_move_size_1_byte) {
-            auto pair = ((ChessBoard*)this)->decode1Byte(moveVec.data() + i);
-            assert(pair.second == 1 || pair.second == 2);
-            move = pair.first;
-            i += pair.second;
-        } else {
-            auto q = reinterpret_cast<const uint16_t*>(moveVec.data() + i);
-            move = ChessBoard::decode2Bytes(*q);
-            i += 2;
-        }
-
-        // data is wrong
-        if (!isValid(move) || _isEmpty(move.from)) {
-            break;
-        }
-
-        auto theSide = side;
-        auto fullmove = createFullMove(move.from, move.dest, move.promotion);
-        _make(fullmove); assert(side != theSide);
-
-        if (flag & ParseMoveListFlag_create_fen) {
-            histList.back().fenString = fenString;
-        }
-        if (flag & ParseMoveListFlag_create_bitboard) {
-            histList.back().bitboardVec = bitboardVec;
-        }
-
-        if (flag & ParseMoveListFlag_create_san) {
-            createSanStringForLastMove();
-        }
+    if (shouldStop) {
+        return _fromMoveList(record, moveVec, flag, shouldStop);
     }
-
-    // last position
-    if (shouldStop && !hit) {
-        bitboardVec = posToBitboards();
-        if (shouldStop(bitboardVec, this, record)) {
-            hit = true;
-        }
-    }
-
-    return true;
+    return _fromMoveList(record, moveVec, flag, nullptr);
 }
 
 
-
 std::string BoardCore::toMoveListString(Notation notation, int itemPerLine, bool moveCounter, CommentComputerInfoType computerInfoType, bool pawnUnit, int precision) const
 {
     return toMoveListString(histList, variant, notation, itemPerLine, moveCounter, computerInfoType, pawnUnit, precision);
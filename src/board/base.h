@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <set>
 #include <unordered_map>
+#include <map>
 
 #include <iomanip> // for setfill, setw
 
@@ -46,15 +47,32 @@ namespace bslib {
         std::vector<Hist> histList;
         std::string firstComment;
 
+        // when on, moves are recorded into histCompactList instead of histList
+        bool histCompactMode = false;
+        std::vector<HistCompact> histCompactList;
+
+        // the last ECO code found while replaying with ParseMoveListFlag_eco
+        bool ecoTracking = false;
+        std::string ecoString;
+
     public:
 
         int getHistListSize() const {
-            return static_cast<int>(histList.size());
+            return static_cast<int>(histCompactMode ? histCompactList.size() : histList.size());
         }
 
         void histListClear() {
             std::lock_guard<std::mutex> dolock(dataMutex);
             histList.clear();
+            histCompactList.clear();
+        }
+
+        bool isHistCompactMode() const {
+            return histCompactMode;
+        }
+
+        const HistCompact* _getHistCompactPointerAt(int idx) const {
+            return idx >= 0 && idx < static_cast<int>(histCompactList.size()) ? &histCompactList[idx] : nullptr;
         }
 
         std::vector<Hist> getHistList() const {
@@ -113,8 +131,17 @@ namespace bslib {
             return _getMoveAt(idx);
         }
         MoveFull _getMoveAt(int idx) const {
+            if (histCompactMode) {
+                return idx >= 0 && idx < static_cast<int>(histCompactList.size()) ? histCompactList.at(idx).move : MoveFull();
+            }
             return idx >= 0 && idx < static_cast<int>(histList.size()) ? histList.at(idx).move : MoveFull();
         }
+        uint64_t _getHashKeyAt(int idx) const {
+            if (histCompactMode) {
+                return histCompactList.at(idx).hashKey;
+            }
+            return histList.at(idx).hashKey;
+        }
         void setFirstComment(const std::string& comment) {
             firstComment = comment;
         }
@@ -202,6 +229,10 @@ namespace bslib {
             side = oboard->side;
             status = oboard->status;
             histList = oboard->histList;
+            histCompactMode = oboard->histCompactMode;
+            histCompactList = oboard->histCompactList;
+            ecoTracking = oboard->ecoTracking;
+            ecoString = oboard->ecoString;
             result = oboard->result;
             variant = oboard->variant;
 
@@ -244,6 +275,10 @@ namespace bslib {
             }
 
             histList.clear();
+            histCompactList.clear();
+            histCompactMode = false;
+            ecoTracking = false;
+            ecoString.clear();
             quietCnt = 0;
             result.result = ResultType::noresult;
         }
@@ -358,6 +393,12 @@ namespace bslib {
         
         virtual std::string getLastEcoString() const = 0;
 
+        /// Classify the current position when replaying with ParseMoveListFlag_eco
+        virtual void _updateEco() = 0;
+
+        /// Maximum numbers of pieces over the replayed game, packed by piece types and sides
+        virtual uint64_t _getMaterialSignature() const = 0;
+
     public:
         bool fromOriginPosition() const;
         virtual std::string getStartingFen() const;
@@ -388,6 +429,8 @@ namespace bslib {
         virtual void _genLegal(std::vector<MoveFull>& moves, Side side, int from = -1, int dest = -1, int promotion = EMPTY);
 
         virtual void _gen(std::vector<MoveFull>& moveList, Side attackerSide) const = 0;
+
+        uint64_t _perft(int depth);
         virtual bool _isIncheck(Side beingAttackedSide) const = 0;
 
         bool checkMake(int from, int dest, int promotion);
@@ -404,12 +447,22 @@ namespace bslib {
             ParseMoveListFlag_parseComment      = 1 << 5,
             
             ParseMoveListFlag_move_size_1_byte  = 1 << 6, // for the 2nd function one only
+            ParseMoveListFlag_compact_hist      = 1 << 7, // record HistCompact only, comments, FENs, SANs, bitboards are not kept
+            ParseMoveListFlag_eco               = 1 << 8, // classify ECO while replaying, read it by getLastEcoString
         };
         
         virtual bool fromMoveList(const PgnRecord* record, Notation, int flag,
-                                  std::function<bool(const std::vector<uint64_t>&, const BoardCore*, const PgnRecord*)> = nullptr);
+                                  std::function<bool(const PositionBB&, const BoardCore*, const PgnRecord*)> = nullptr);
 
-        virtual bool fromMoveList(const PgnRecord*, const std::vector<int8_t>& moveVec, int flag, std::function<bool(const std::vector<uint64_t>& bitboardVec, const BoardCore*, const PgnRecord*)> = nullptr);
+        virtual bool fromMoveList(const PgnRecord*, const std::vector<int8_t>& moveVec, int flag, std::function<bool(const PositionBB&, const BoardCore*, const PgnRecord*)> = nullptr);
+
+        template<class StopFunc>
+        bool _fromMoveList(const PgnRecord*, Notation, int flag, StopFunc&& shouldStop);
+        template<class StopFunc>
+        bool _fromMoveList(const PgnRecord*, const std::vector<int8_t>& moveVec, int flag, StopFunc&& shouldStop);
+
+        void _parseMoveText(const PgnRecord*, int flag, std::vector<std::string>& moveStringVec, std::map<size_t, std::string>& commentMap) const;
+        virtual std::pair<Move, int> _decodeMove(const int8_t* data, bool oneByte) = 0;
 
         std::vector<HistBasic> parsePv(const std::string& pvString, bool isCoordinateOnly);
         std::vector<HistBasic> _parsePv(const std::string& pvString, bool isCoordinateOnly);
@@ -445,19 +498,234 @@ namespace bslib {
         virtual void _make(const MoveFull& move, Hist& hist) = 0;
         virtual void _takeBack(const Hist& hist) = 0;
 
-        virtual int findKing(Side side) const;
-        virtual std::vector<uint64_t> posToBitboards() const = 0;
+        virtual void _make(const MoveFull& move, HistCompact& hist) = 0;
+        virtual void _takeBack(const HistCompact& hist) = 0;
 
-    protected:
+        virtual int findKing(Side side) const;
+        virtual void posToBitboards(PositionBB&) const = 0;
         virtual bool createSanStringForLastMove() = 0;
 
+    protected:
         void setupPieceIndexes();
 
         virtual uint64_t xorHashKey(int pos) const = 0;
         virtual uint64_t xorSideHashKey() const = 0;
 
     };
-    
+
+    /// Replay a move list without locking, for boards owned by a single thread.
+    /// shouldStop is called for each position (when ParseMoveListFlag_create_bitboard is set),
+    /// it could be a lambda or nullptr thus the check can be inlined
+    template<class StopFunc>
+    bool BoardCore::_fromMoveList(const PgnRecord* record, Notation notation, int flag, StopFunc&& shouldStop)
+    {
+        constexpr bool hasStop = !std::is_same<typename std::decay<StopFunc>::type, std::nullptr_t>::value;
+
+        std::vector<std::string> moveStringVec;
+        std::map<size_t, std::string> commentMap;
+        _parseMoveText(record, flag, moveStringVec, commentMap);
+
+        std::string fenString;
+        PositionBB bitboards;
+
+        if (histList.empty() && histCompactList.empty()) {
+            histCompactMode = (flag & ParseMoveListFlag_compact_hist) != 0;
+            ecoTracking = (flag & ParseMoveListFlag_eco) != 0;
+            ecoString.clear();
+        }
+
+        auto hit = false;
+        for(size_t i = 0; i < moveStringVec.size(); i++) {
+            const auto& ss = moveStringVec.at(i);
+
+            Move move;
+
+            if (notation == Notation::san) {
+                move = moveFromString_san(ss);
+            } else {
+                move = moveFromString_coordinate(ss);
+            }
+
+            if (move == Move::illegalMove) {
+                return false;
+            }
+
+            /// Parse comment before making move for parsing pv
+            auto hasComment = false;
+
+            Hist tmphist;
+            if (!commentMap.empty() && !histCompactMode) {
+                auto it = commentMap.find(i + 1);
+                if (it != commentMap.end()) {
+                    if (flag & ParseMoveListFlag_parseComment) {
+                        _parseComment(it->second, tmphist);
+                    } else {
+                        if (!tmphist.comment.empty()) {
+                            tmphist.comment += ", ";
+                        }
+                        tmphist.comment += it->second;
+                    }
+                    hasComment = true;
+                }
+            }
+
+            if ((flag & ParseMoveListFlag_create_fen) && !histCompactMode) {
+                fenString = getFen();
+            }
+            if (flag & ParseMoveListFlag_create_bitboard) {
+                posToBitboards(bitboards);
+                assert(bitboards.isValid());
+
+                if constexpr (hasStop) {
+                    if (shouldStop(bitboards, this, record)) {
+                        hit = true;
+                        break;
+                    }
+                }
+            }
+
+            if (ecoTracking) {
+                _updateEco();
+            }
+
+            if (flag & ParseMoveListFlag_quick_check) {
+                if (!_quickCheckMake(move.from, move.dest, move.promotion, false)) {
+                    return false;
+                }
+            } else {
+                if (!_checkMake(move.from, move.dest, move.promotion)) {
+                    return false;
+                }
+            }
+
+            if (histCompactMode) {
+                continue;
+            }
+
+            assert(!histList.empty());
+            if (hasComment) {
+                histList.back().comment = tmphist.comment;
+                histList.back().esVec = tmphist.esVec;
+            }
+
+            if (flag & ParseMoveListFlag_create_fen) {
+                histList.back().fenString = fenString;
+            }
+
+            if (flag & ParseMoveListFlag_create_bitboard) {
+                histList.back().bitboards = bitboards;
+            }
+
+            if (flag & ParseMoveListFlag_create_san) {
+                if (notation == Notation::san) {
+                    histList.back().sanString = ss;
+                } else {
+                    // missing function
+                }
+            }
+        }
+
+        // first comments
+        {
+            firstComment.clear();
+            auto it = commentMap.find(0);
+            if (it != commentMap.end()) {
+                firstComment = it->second;
+            }
+        }
+
+        // last position
+        if constexpr (hasStop) {
+            if (!hit) {
+                posToBitboards(bitboards);
+                if (shouldStop(bitboards, this, record)) {
+                    hit = true;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    template<class StopFunc>
+    bool BoardCore::_fromMoveList(const PgnRecord* record, const std::vector<int8_t>& moveVec, int flag, StopFunc&& shouldStop)
+    {
+        constexpr bool hasStop = !std::is_same<typename std::decay<StopFunc>::type, std::nullptr_t>::value;
+
+        std::string fenString;
+        PositionBB bitboards;
+
+        if (histList.empty() && histCompactList.empty()) {
+            histCompactMode = (flag & ParseMoveListFlag_compact_hist) != 0;
+            ecoTracking = (flag & ParseMoveListFlag_eco) != 0;
+            ecoString.clear();
+        }
+
+        auto hit = false;
+
+        for(size_t i = 0; i < moveVec.size();) {
+            if ((flag & ParseMoveListFlag_create_fen) && !histCompactMode) {
+                fenString = getFen();
+            }
+
+            if (flag & ParseMoveListFlag_create_bitboard) {
+                posToBitboards(bitboards);
+                assert(bitboards.isValid());
+
+                if constexpr (hasStop) {
+                    if (shouldStop(bitboards, this, record)) {
+                        hit = true;
+                        break;
+                    }
+                }
+            }
+
+            auto pair = _decodeMove(moveVec.data() + i, flag & ParseMoveListFlag_move_size_1_byte);
+            assert(pair.second == 1 || pair.second == 2);
+            auto move = pair.first;
+            i += pair.second;
+
+            // data is wrong
+            if (!isValid(move) || _isEmpty(move.from)) {
+                break;
+            }
+
+            if (ecoTracking) {
+                _updateEco();
+            }
+
+            auto theSide = side;
+            auto fullmove = createFullMove(move.from, move.dest, move.promotion);
+            _make(fullmove); assert(side != theSide);
+
+            if (histCompactMode) {
+                continue;
+            }
+
+            if (flag & ParseMoveListFlag_create_fen) {
+                histList.back().fenString = fenString;
+            }
+            if (flag & ParseMoveListFlag_create_bitboard) {
+                histList.back().bitboards = bitboards;
+            }
+
+            if (flag & ParseMoveListFlag_create_san) {
+                createSanStringForLastMove();
+            }
+        }
+
+        // last position
+        if constexpr (hasStop) {
+            if (!hit) {
+                posToBitboards(bitboards);
+                if (shouldStop(bitboards, this, record)) {
+                    hit = true;
+                }
+            }
+        }
+
+        return true;
+    }
 
 } // namespace ocgdb
 
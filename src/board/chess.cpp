@@ -8,6 +8,7 @@
  * or copy at http://opensource.org/licenses/MIT)
  */
 
+#include <algorithm>
 #include <random>
 #include <iomanip> // for setprecision
 #include <fstream>
@@ -878,6 +879,28 @@ bool ChessBoard::beAttacked(int pos, Side attackerSide) const
 }
 
 void ChessBoard::_make(const MoveFull& move, Hist& hist)
+{
+    _makeHist(move, hist);
+}
+
+void ChessBoard::_make(const MoveFull& move, HistCompact& hist)
+{
+    _makeHist(move, hist);
+}
+
+void ChessBoard::_takeBack(const Hist& hist)
+{
+    _takeBackHist(hist);
+}
+
+void ChessBoard::_takeBack(const HistCompact& hist)
+{
+    _takeBackHist(hist);
+}
+
+// Hist and HistCompact share the same names for the undo information
+template<class H>
+void ChessBoard::_makeHist(const MoveFull& move, H& hist)
 {
     hist.enpassant = enpassant;
     hist.status = status;
@@ -990,7 +1013,8 @@ void ChessBoard::_make(const MoveFull& move, Hist& hist)
     assert(hist.move.piece.idx == pieces[move.dest].idx);
 }
 
-void ChessBoard::_takeBack(const Hist& hist)
+template<class H>
+void ChessBoard::_takeBackHist(const H& hist)
 {
     auto movep = pieces[hist.move.dest];
     pieces[hist.move.from] = movep;
@@ -1877,6 +1901,193 @@ Move ChessBoard::moveFromString_castling(const std::string& str, Side side) cons
     return Move(from, dest, EMPTY);
 }
 
+/// Find the from square of a SAN move by looking back from the destination:
+/// only squares which could reach dest are checked, no move generating.
+/// If there are several candidates, the first one (by position) not leaving
+/// the king in check is selected, the same as the generator-based resolver
+int ChessBoard::_sanFindFrom(int pieceType, int dest, int promotion, int fromCol, int fromRow)
+{
+    auto cap = _getPiece(dest);
+    if (cap.side == side) {
+        return -1;
+    }
+
+    auto isPawn = pieceType == static_cast<int>(PieceTypeStd::pawn);
+    if (isPawn && (dest < 8 || dest >= 56)) {
+        if (!isValidPromotion(promotion, side)) {
+            return -1;
+        }
+    } else if (promotion != EMPTY) {
+        return -1;
+    }
+
+    int candidates[16], n = 0;
+    auto rd = dest / 8, fd = dest % 8;
+
+    auto add = [&](int pos) {
+        if (n < 16
+            && (fromRow < 0 || pos / 8 == fromRow)
+            && (fromCol < 0 || pos % 8 == fromCol)) {
+            candidates[n++] = pos;
+        }
+    };
+
+    /// walk along a direction from dest, the first piece met is the only candidate
+    auto slide = [&](int dr, int df) {
+        for(auto r = rd + dr, f = fd + df; r >= 0 && r < 8 && f >= 0 && f < 8; r += dr, f += df) {
+            auto pos = r * 8 + f;
+            if (!_isEmpty(pos)) {
+                if (_isPiece(pos, pieceType, side)) {
+                    add(pos);
+                }
+                break;
+            }
+        }
+    };
+
+    switch (static_cast<PieceTypeStd>(pieceType)) {
+        case PieceTypeStd::pawn:
+        {
+            /// white pawns move up (to smaller positions)
+            auto d = side == Side::white ? 8 : -8;
+            if (cap.isEmpty()) {
+                auto pos = dest + d;
+                if (pos >= 0 && pos < 64) {
+                    if (_isPiece(pos, pieceType, side)) {
+                        add(pos);
+                    } else if (_isEmpty(pos) && rd == (side == Side::white ? 4 : 3)
+                               && _isPiece(pos + d, pieceType, side)) {
+                        add(pos + d);
+                    }
+                }
+            }
+
+            if (!cap.isEmpty() || dest == enpassant) {
+                auto r = rd + (side == Side::white ? 1 : -1);
+                if (r >= 0 && r < 8) {
+                    if (fd > 0 && _isPiece(r * 8 + fd - 1, pieceType, side)) {
+                        add(r * 8 + fd - 1);
+                    }
+                    if (fd < 7 && _isPiece(r * 8 + fd + 1, pieceType, side)) {
+                        add(r * 8 + fd + 1);
+                    }
+                }
+            }
+            break;
+        }
+
+        case PieceTypeStd::knight:
+        {
+            static const int knightSteps[8][2] = {
+                { -2, -1 }, { -2, 1 }, { -1, -2 }, { -1, 2 },
+                { 1, -2 }, { 1, 2 }, { 2, -1 }, { 2, 1 }
+            };
+            for(auto && step : knightSteps) {
+                auto r = rd + step[0], f = fd + step[1];
+                if (r >= 0 && r < 8 && f >= 0 && f < 8 && _isPiece(r * 8 + f, pieceType, side)) {
+                    add(r * 8 + f);
+                }
+            }
+            break;
+        }
+
+        case PieceTypeStd::king:
+        {
+            for(auto r = std::max(0, rd - 1); r <= std::min(7, rd + 1); r++) {
+                for(auto f = std::max(0, fd - 1); f <= std::min(7, fd + 1); f++) {
+                    auto pos = r * 8 + f;
+                    if (pos != dest && _isPiece(pos, pieceType, side)) {
+                        add(pos);
+                    }
+                }
+            }
+
+            /// castling written as a king move (Kg1, Kc8...)
+            auto kingPos = side == Side::white ? 60 : 4;
+            if (n == 0 && (dest == kingPos + 2 || dest == kingPos - 2) && _isPiece(kingPos, pieceType, side)) {
+                std::vector<MoveFull> moveList;
+                gen_castling(moveList, kingPos);
+                for(auto && m : moveList) {
+                    if (m.dest == dest) {
+                        add(kingPos);
+                    }
+                }
+            }
+            break;
+        }
+
+        default:
+        {
+            auto isQueen = pieceType == static_cast<int>(PieceTypeStd::queen);
+            if (isQueen || pieceType == static_cast<int>(PieceTypeStd::rook)) {
+                slide(-1, 0); slide(1, 0); slide(0, -1); slide(0, 1);
+            }
+            if (isQueen || pieceType == static_cast<int>(PieceTypeStd::bishop)) {
+                slide(-1, -1); slide(-1, 1); slide(1, -1); slide(1, 1);
+            }
+            break;
+        }
+    }
+
+    if (n <= 1) {
+        return n ? candidates[0] : -1;
+    }
+
+    std::sort(candidates, candidates + n);
+
+    /// several candidates, normally because of pins
+    for(auto i = 0; i < n; i++) {
+        MoveFull move = createFullMove(candidates[i], dest, promotion);
+        HistCompact hist;
+        _make(move, hist);
+        auto incheck = _isIncheck(side);
+        _takeBack(hist);
+        if (!incheck) {
+            return candidates[i];
+        }
+    }
+    return candidates[n - 1];
+}
+
+/// The old resolver, by generating all moves then filtering, kept for
+/// checking _sanFindFrom in debug mode
+int ChessBoard::_sanFindFrom_gen(int pieceType, int dest, int promotion, int fromCol, int fromRow)
+{
+    int from = -1;
+    std::vector<MoveFull> moveList;
+    _gen(moveList, side);
+
+    std::vector<Move> goodMoves;
+    for (auto && m : moveList) {
+        if (m.dest != dest || m.promotion != promotion ||
+            _getPiece(m.from).type != pieceType) {
+            continue;
+        }
+
+        if ((fromRow < 0 && fromCol < 0) ||
+            (fromRow >= 0 && getRank(m.from) == fromRow) ||
+            (fromCol >= 0 && getColumn(m.from) == fromCol)) {
+            goodMoves.push_back(m);
+            from = m.from;
+        }
+    }
+
+    if (goodMoves.size() > 1) {
+        for(auto && m : goodMoves) {
+            MoveFull move = createFullMove(m.from, dest, promotion);
+            Hist hist;
+            _make(move, hist);
+            auto incheck = _isIncheck(side);
+            _takeBack(hist);
+            if (!incheck) {
+                from = m.from;
+                break;
+            }
+        }
+    }
+    return from;
+}
+
 Move ChessBoard::moveFromString_san(const std::string& str)
 {
     if (str.length() < 2) {
@@ -1955,36 +2166,13 @@ Move ChessBoard::moveFromString_san(const std::string& str)
     }
 
     if (from < 0) {
-        std::vector<MoveFull> moveList;
-        _gen(moveList, side);
-
-        std::vector<Move> goodMoves;
-        for (auto && m : moveList) {
-            if (m.dest != dest || m.promotion != promotion ||
-                _getPiece(m.from).type != pieceType) {
-                continue;
-            }
+        from = _sanFindFrom(pieceType, dest, promotion, fromCol, fromRow);
 
-            if ((fromRow < 0 && fromCol < 0) ||
-                (fromRow >= 0 && getRank(m.from) == fromRow) ||
-                (fromCol >= 0 && getColumn(m.from) == fromCol)) {
-                goodMoves.push_back(m);
-                from = m.from;
-            }
-        }
-
-        if (goodMoves.size() > 1) {
-            for(auto && m : goodMoves) {
-                MoveFull move = createFullMove(m.from, dest, promotion);
-                Hist hist;
-                _make(move, hist);
-                auto incheck = _isIncheck(side);
-                _takeBack(hist);
-                if (!incheck) {
-                    from = m.from;
-                    break;
-                }
-            }
+        /// differential check against the generator-based resolver
+        if (sanCrossCheckFunc) {
+            sanCrossCheckFunc(str, from, _sanFindFrom_gen(pieceType, dest, promotion, fromCol, fromRow));
+        } else {
+            assert(from == _sanFindFrom_gen(pieceType, dest, promotion, fromCol, fromRow));
         }
     }
     
@@ -2403,12 +2591,12 @@ uint64_t polyglotRandom64[800] = {
 uint64_t ChessBoard::getHashKeyForCheckingDuplicates(int h) const
 {
     uint64_t hk;
-    size_t n = histList.size(), t;
+    int n = getHistListSize(), t;
     if (h < 0 || h >= n) {
         hk = hashKey;
         t = n;
     } else {
-        hk = histList.at(h).hashKey;
+        hk = _getHashKeyAt(h);
         t = h;
     }
 
@@ -2416,7 +2604,8 @@ uint64_t ChessBoard::getHashKeyForCheckingDuplicates(int h) const
 }
 
 
-static const std::unordered_map<uint64_t, std::string> ecoMap
+/// Source of the ECO table: hash key of the position, ECO code; opening name
+static const std::pair<uint64_t, const char*> ecoSourceTable[] =
 {
     
     {17746977930792137ULL, "D08;QGD; Albin counter-gambit"},{18828346148881476ULL, "D20;QGA; Linares variation"},{22186996187002557ULL, "D57;QGD; Lasker defence, Bernstein variation"},{34585945880640199ULL, "C55;two knights; Max Lange attack, Loman defence"},
@@ -2872,21 +3061,142 @@ static const std::unordered_map<uint64_t, std::string> ecoMap
     
 };
 
-std::string ChessBoard::getLastEcoString() const
+/// Compact ECO table, built once by staticInit from ecoSourceTable: an open
+/// addressing hash table of keys with their ECO codes only (already split)
+struct EcoEntry {
+    uint64_t key;
+    char code[4];
+};
+
+static std::vector<EcoEntry> ecoHashTable;
+static uint64_t ecoHashMask = 0;
+
+/// ECO lines of the table end in the opening, positions after this ply are not probed.
+/// The table keeps hash keys only, its depth was measured by searching from the starting
+/// position through at most two positions in a row not in the table: 1463 of its 1800
+/// positions are reached, the deepest at ply 20. The rest are covered by the assert
+/// of _updateEco, which checks in debug builds that no later position is in the table
+static const int EcoMaxPly = 60;
+
+static void initEcoHashTable()
 {
-    std::string ecoString;
-    for(auto && hist : histList) {
-        auto it = ecoMap.find(hist.hashKey);
-        if (it != ecoMap.end()) {
-            auto vec = Funcs::splitString(it->second, ';');
-            if (!vec.empty()) {
-                ecoString = vec.front();
+    auto n = sizeof(ecoSourceTable) / sizeof(ecoSourceTable[0]);
+    size_t sz = 1024;
+    while (sz < n * 2) {
+        sz <<= 1;
+    }
+
+    ecoHashTable.assign(sz, EcoEntry { 0, { 0, 0, 0, 0 } });
+    ecoHashMask = sz - 1;
+
+    for(auto && p : ecoSourceTable) {
+        assert(p.first);
+        for(auto i = p.first & ecoHashMask; ; i = (i + 1) & ecoHashMask) {
+            auto& e = ecoHashTable[i];
+            if (e.key == p.first) { // duplicate, keep the first one
+                break;
+            }
+            if (e.key == 0) {
+                e.key = p.first;
+                for(auto k = 0; k < 3 && p.second[k] && p.second[k] != ';'; k++) {
+                    e.code[k] = p.second[k];
+                }
+                break;
             }
         }
     }
-    return ecoString;
 }
 
+static const char* findEcoCode(uint64_t key)
+{
+    assert(!ecoHashTable.empty());
+    for(auto i = key & ecoHashMask; ; i = (i + 1) & ecoHashMask) {
+        auto& e = ecoHashTable[i];
+        if (e.key == key) {
+            return e.code;
+        }
+        if (e.key == 0) {
+            return nullptr;
+        }
+    }
+}
+
+void ChessBoard::_updateEco()
+{
+    if (getHistListSize() < EcoMaxPly) {
+        auto code = findEcoCode(hashKey);
+        if (code) {
+            ecoString = code;
+        }
+        return;
+    }
+
+    // the cutoff must not drop any ECO code
+    assert(!findEcoCode(hashKey));
+}
+
+std::string ChessBoard::getLastEcoString() const
+{
+    if (ecoTracking) {
+        return ecoString;
+    }
+
+    std::string str;
+    for(int i = 0, n = std::min(getHistListSize(), EcoMaxPly); i < n; i++) {
+        auto code = findEcoCode(_getHashKeyAt(i));
+        if (code) {
+            str = code;
+        }
+    }
+    return str;
+}
+
+/// Material only decreases except by promotions, thus the maximum numbers are
+/// found by taking back captures and promotions from the last position
+uint64_t ChessBoard::_getMaterialSignature() const
+{
+    int cnt[2][7] = {}, maxCnt[2][7];
+    for(auto && piece : pieces) {
+        if (!piece.isEmpty()) {
+            cnt[static_cast<int>(piece.side)][piece.type]++;
+        }
+    }
+    memcpy(maxCnt, cnt, sizeof(cnt));
+
+    auto moveSide = xSide(side); // the side of the last move
+    for(auto i = getHistListSize() - 1; i >= 0; i--) {
+        Piece cap;
+        int promotion;
+        if (histCompactMode) {
+            cap = histCompactList[i].cap;
+            promotion = histCompactList[i].move.promotion;
+        } else {
+            cap = histList[i].cap;
+            promotion = histList[i].move.promotion;
+        }
+
+        auto sd = static_cast<int>(moveSide);
+        if (!cap.isEmpty()) {
+            cnt[1 - sd][cap.type]++;
+            maxCnt[1 - sd][cap.type] = std::max(maxCnt[1 - sd][cap.type], cnt[1 - sd][cap.type]);
+        }
+        if (promotion > KING) {
+            cnt[sd][promotion]--;
+            cnt[sd][PAWNSTD]++;
+            maxCnt[sd][PAWNSTD] = std::max(maxCnt[sd][PAWNSTD], cnt[sd][PAWNSTD]);
+        }
+        moveSide = xSide(moveSide);
+    }
+
+    uint64_t signature = 0;
+    for(auto sd = 0; sd < 2; sd++) {
+        for(auto type = KING; type <= PAWNSTD; type++) {
+            auto n = static_cast<uint64_t>(std::min(maxCnt[sd][type], 15));
+            signature |= n << materialSignatureShift(static_cast<Side>(sd), type);
+        }
+    }
+    return signature;
+}
 
 //////////////////////
 uint64_t ChessBoard::_posToBitboard[64];
@@ -2919,6 +3229,8 @@ static std::vector<int> bishopStartPointsVec;
 
 void ChessBoard::staticInit()
 {
+    initEcoHashTable();
+
     bb_edge_left = bb_edge_right = 0;
     bb_edge_bottom = 0xffULL;
     bb_edge_top = 0xffULL << 56;
@@ -2984,14 +3296,10 @@ uint64_t ChessBoard::posToBitboard(const char* s)
     return 0;
 }
 
-std::vector<uint64_t> ChessBoard::posToBitboards() const
+void ChessBoard::posToBitboards(PositionBB& vec) const
 {
-    std::vector<uint64_t> vec = {   hashKey, 0ULL, 0ULL, 0ULL, 0ULL,
-                                    0ULL, 0ULL, 0ULL, 0ULL, 0ULL,
-                                    0ULL, 0ULL
-
-    };
-    assert(vec.size() == static_cast<int>(BBIdx::max));
+    vec.bb.fill(0);
+    vec[BBIdx::hash] = hashKey;
     
     for (int i = 0; i < 64; i++) {
         auto piece = _getPiece(i);
@@ -3009,11 +3317,15 @@ std::vector<uint64_t> ChessBoard::posToBitboards() const
         }
     }
 
+    vec.side = static_cast<int8_t>(side);
+    vec.castleRights[0] = castleRights[0];
+    vec.castleRights[1] = castleRights[1];
+    vec.enpassant = enpassant;
+
     int64_t rights0 = castleRights[0], rights1 = castleRights[1];
-    vec[static_cast<int>(BBIdx::prop)] = (enpassant & 0xff) | rights0 << 8 | rights1 << 10;
-    assert(vec[static_cast<int>(BBIdx::hash)] && vec[static_cast<int>(BBIdx::black)] && vec[static_cast<int>(BBIdx::white)]); // two sides and king must be not zero
-    assert(vec[static_cast<int>(BBIdx::blackkingsquare)] != vec[static_cast<int>(BBIdx::whitekingsquare)]);
-    return vec;
+    vec[BBIdx::prop] = (enpassant & 0xff) | rights0 << 8 | rights1 << 10;
+    assert(vec[BBIdx::hash] && vec[BBIdx::black] && vec[BBIdx::white]); // two sides and king must be not zero
+    assert(vec[BBIdx::blackkingsquare] != vec[BBIdx::whitekingsquare]);
 }
 
 
@@ -3171,6 +3483,14 @@ std::pair<uint16_t, int> ChessBoard::encode1Byte(MoveFull move)
     return pair;
 }
 
+std::pair<Move, int> ChessBoard::_decodeMove(const int8_t* data, bool oneByte)
+{
+    if (oneByte) {
+        return decode1Byte(data);
+    }
+    return { decode2Bytes(*reinterpret_cast<const uint16_t*>(data)), 2 };
+}
+
 std::pair<Move, int> ChessBoard::decode1Byte(const int8_t* d)
 {
     // first 4 bits is the index of the piece
@@ -53,6 +53,8 @@ namespace bslib {
 
         virtual void _make(const MoveFull& move, Hist& hist) override;
         virtual void _takeBack(const Hist& hist) override;
+        virtual void _make(const MoveFull& move, HistCompact& hist) override;
+        virtual void _takeBack(const HistCompact& hist) override;
         virtual bool _checkMake(int from, int dest, int promotion) override;
         virtual bool _quickCheckMake(int from, int dest, int promotion, bool createSanString) override;
 
@@ -120,6 +122,10 @@ namespace bslib {
         virtual Move moveFromString_san(const std::string&) override;
         virtual Move moveFromString_castling(const std::string& str, Side side) const;
 
+        /// If set, SAN moves are resolved by both resolvers (_sanFindFrom and the old
+        /// _sanFindFrom_gen), then it is called with the SAN string and both from squares
+        std::function<void(const std::string&, int, int)> sanCrossCheckFunc;
+
         static bool isChessFenValid(const std::string& fen);
         static void staticInit();
 
@@ -133,10 +139,19 @@ namespace bslib {
         static Move decode2Bytes(uint16_t d);
         static std::pair<uint16_t, int> encode1Byte(MoveFull move);
         std::pair<Move, int> decode1Byte(const int8_t* d);
+        virtual std::pair<Move, int> _decodeMove(const int8_t* data, bool oneByte) override;
 
         virtual uint64_t getHashKeyForCheckingDuplicates(int) const override;
 
         virtual std::string getLastEcoString() const override;
+        virtual void _updateEco() override;
+
+        virtual uint64_t _getMaterialSignature() const override;
+
+        /// Each piece type of each side has 4 bits in the material signature
+        static int materialSignatureShift(Side side, int type) {
+            return (static_cast<int>(side) * 6 + type - 1) * 4;
+        }
 
     protected:
         bool canRivalCaptureEnpassant() const;
@@ -178,7 +193,7 @@ namespace bslib {
 
         void gen_addMove(std::vector<MoveFull>& moveList, int from, int dest, bool capOnly) const;
 
-        virtual std::vector<uint64_t> posToBitboards() const override;
+        virtual void posToBitboards(PositionBB&) const override;
 
     protected:
         uint64_t hashKeyEnpassant(int enpassant) const;
@@ -186,6 +201,12 @@ namespace bslib {
         virtual uint64_t xorSideHashKey() const override;
 
     private:
+        template<class H> void _makeHist(const MoveFull& move, H& hist);
+        template<class H> void _takeBackHist(const H& hist);
+
+        int _sanFindFrom(int pieceType, int dest, int promotion, int fromCol, int fromRow);
+        int _sanFindFrom_gen(int pieceType, int dest, int promotion, int fromCol, int fromRow);
+
         void checkEnpassant();
         
         virtual uint64_t initHashKey() const override;
@@ -19,6 +19,12 @@
 #include <mutex>
 #include <functional>
 #include <cstring>
+#include <array>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #include "types.h"
 #include "funcs.h"
@@ -227,6 +233,114 @@ public:
     }
 };
 
+/// Fixed-size bitboard snapshot of a position, trivially copyable
+/// and aligned to a cache line so evaluating a position is allocation-free
+class alignas(64) PositionBB {
+public:
+    std::array<uint64_t, static_cast<int>(BBIdx::max)> bb;
+    int8_t side, castleRights[2];
+    int enpassant;
+
+    void reset() {
+        bb.fill(0);
+        side = static_cast<int8_t>(Side::none);
+        castleRights[0] = castleRights[1] = 0;
+        enpassant = -1;
+    }
+
+    bool isValid() const {
+        return bb[static_cast<int>(BBIdx::hash)] && (bb[static_cast<int>(BBIdx::black)] | bb[static_cast<int>(BBIdx::white)]);
+    }
+
+    uint64_t& operator[](int idx) {
+        return bb[idx];
+    }
+    uint64_t operator[](int idx) const {
+        return bb[idx];
+    }
+    uint64_t& operator[](BBIdx idx) {
+        return bb[static_cast<int>(idx)];
+    }
+    uint64_t operator[](BBIdx idx) const {
+        return bb[static_cast<int>(idx)];
+    }
+};
+
+static_assert(std::is_trivially_copyable<PositionBB>::value, "PositionBB must be trivially copyable");
+
+/// Number of set bits of a bitboard
+inline int popCount(uint64_t x)
+{
+#if defined(_MSC_VER)
+    return static_cast<int>(__popcnt64(x));
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+/// Index of the lowest set bit, the bitboard must not be zero
+inline int bitScan(uint64_t x)
+{
+    assert(x);
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+/// Bitboards of some consecutive positions in structure-of-arrays layout
+/// (one array per bitboard index), for evaluating them together
+class alignas(64) PositionBatch {
+public:
+    static const int MaxSize = 8;
+
+    std::array<std::array<uint64_t, MaxSize>, static_cast<int>(BBIdx::max)> bb {};
+    int size = 0;
+
+    void add(const PositionBB& bitboards) {
+        assert(size < MaxSize);
+        for(auto i = 0; i < static_cast<int>(BBIdx::max); i++) {
+            bb[i][size] = bitboards[i];
+        }
+        size++;
+    }
+
+    void get(int k, PositionBB& bitboards) const {
+        assert(k >= 0 && k < size);
+        bitboards.reset();
+        for(auto i = 0; i < static_cast<int>(BBIdx::max); i++) {
+            bitboards[i] = bb[i][k];
+        }
+    }
+
+    bool isFull() const {
+        return size >= MaxSize;
+    }
+    bool empty() const {
+        return size == 0;
+    }
+    void clear() {
+        size = 0;
+    }
+};
+
+/// Compact history record: a move with its undo information only.
+/// Used instead of Hist when replaying games in bulk (searching, checking
+/// duplicates, encoding moves) where comments, FENs, SANs are not needed
+class HistCompact {
+public:
+    MoveFull move;
+    Piece cap;
+    int8_t enpassant, castled, castleRights[2];
+    int16_t status, quietCnt;
+    uint64_t hashKey;
+};
+
+static_assert(std::is_trivially_copyable<HistCompact>::value, "HistCompact must be trivially copyable");
+
 class HistBasic {
 public:
     MoveFull move;
@@ -294,7 +408,7 @@ public:
     int64_t hashKey;
     int quietCnt;
     std::string comment, fenString; // moveString,
-    std::vector<uint64_t> bitboardVec;
+    PositionBB bitboards;
 
     std::vector<EngineScore> esVec;
 
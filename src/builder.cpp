@@ -20,6 +20,7 @@
 
 #include "board/chess.h"
 #include "builder.h"
+#include "similar.h"
 
 
 using namespace ocgdb;
@@ -128,6 +129,16 @@ void Builder::create()
                 std::cout << "WARNING: redundant! There are two binary columns for storing moves. Use Moves2, discard Move1" << std::endl;
             }
         }
+
+        if ((paraRecord.optionFlag & create_flag_positions) && !(movebit & (create_flag_moves1 | create_flag_moves2))) {
+            std::cout << "WARNING: table Positions needs a binary column for storing moves, discard it" << std::endl;
+            paraRecord.optionFlag &= ~create_flag_positions;
+        }
+
+        if ((paraRecord.optionFlag & create_flag_similar) && !(movebit & (create_flag_moves1 | create_flag_moves2))) {
+            std::cout << "WARNING: table SimilarPositions needs a binary column for storing moves, discard it" << std::endl;
+            paraRecord.optionFlag &= ~create_flag_similar;
+        }
     }
 
     // init
@@ -156,6 +167,8 @@ void Builder::create()
     // completing
     {
         updateInfoTable();
+        createPositionIndex();
+        createSimilarIndex();
         
         if (playerInsertStatement) delete playerInsertStatement;
         playerInsertStatement = nullptr;
@@ -191,6 +204,75 @@ void Builder::updateInfoTable()
     mDb->exec(str);
 }
 
+/// Hash keys of positions after each move of the replayed game, the starting position is not counted
+void Builder::insertPositions(ThreadRecord* t, IDInteger gameID)
+{
+    assert(t && t->board);
+    if (!t->insertPositionStatement) {
+        t->insertPositionStatement = new SQLite::Statement(*mDb, "INSERT INTO Positions (Hash, GameID, Ply) VALUES (?, ?, ?)");
+    }
+
+    for(int i = 1, n = t->board->getHistListSize(); i <= n; i++) {
+        auto hashKey = i < n ? t->board->_getHashKeyAt(i) : t->board->hashKey;
+        t->insertPositionStatement->reset();
+        t->insertPositionStatement->bind(1, static_cast<long long>(hashKey));
+        t->insertPositionStatement->bind(2, gameID);
+        t->insertPositionStatement->bind(3, i);
+        t->insertPositionStatement->exec();
+    }
+}
+
+void Builder::createPositionIndex()
+{
+    if (create_positionTable) {
+        std::cout << "Creating index for table Positions..." << std::endl;
+        mDb->exec("CREATE INDEX IF NOT EXISTS PositionHash ON Positions (Hash)");
+    }
+}
+
+/// Pieces and band keys of positions after each move, replayed on board2 from the starting position
+void Builder::insertSimilarPositions(ThreadRecord* t, IDInteger gameID)
+{
+    assert(t && t->board && t->board2);
+    if (!t->insertSimilarStatement) {
+        t->insertSimilarStatement = new SQLite::Statement(*mDb, SimilarIndex::insertString());
+    }
+
+    t->board2->_newGame(t->board->getStartingFen());
+
+    bslib::HistCompact hist;
+    bslib::PositionBB bitboards;
+    int64_t bands[SimilarIndex::BandCount];
+    uint64_t pieceBoards[SimilarIndex::PieceBoardCount];
+
+    for(int i = 0, n = t->board->getHistListSize(); i < n; i++) {
+        t->board2->_make(t->board->_getMoveAt(i), hist);
+        t->board2->posToBitboards(bitboards);
+        SimilarIndex::computeBands(bitboards, bands);
+        SimilarIndex::getPieceBoards(bitboards, pieceBoards);
+
+        t->insertSimilarStatement->reset();
+        t->insertSimilarStatement->bind(1, gameID);
+        t->insertSimilarStatement->bind(2, i + 1);
+        t->insertSimilarStatement->bind(3, pieceBoards, static_cast<int>(sizeof(pieceBoards)));
+        for(auto j = 0; j < SimilarIndex::BandCount; j++) {
+            t->insertSimilarStatement->bind(4 + j, static_cast<long long>(bands[j]));
+        }
+        t->insertSimilarStatement->exec();
+    }
+}
+
+void Builder::createSimilarIndex()
+{
+    if (create_similarTable) {
+        std::cout << "Creating indexes for table SimilarPositions..." << std::endl;
+        for(auto i = 0; i < SimilarIndex::BandCount; i++) {
+            auto s = std::to_string(i);
+            mDb->exec("CREATE INDEX IF NOT EXISTS SimilarBand" + s + " ON SimilarPositions (Band" + s + ")");
+        }
+    }
+}
+
 void Builder::printStats() const
 {
     DbCore::printStats();
@@ -222,7 +304,12 @@ bool Builder::createDb(const std::string& dbPath)
     eventCnt = playerCnt = siteCnt = 1;
     errCnt = 0;
     
-    // ID, FEN, Moves, Moves1, Moves2 are special columns
+    // games are replayed for binary moves only, so is their material signature
+    create_materialColumn = (paraRecord.optionFlag & (create_flag_moves1 | create_flag_moves2)) != 0;
+    create_positionTable = (paraRecord.optionFlag & create_flag_positions) != 0;
+    create_similarTable = (paraRecord.optionFlag & create_flag_similar) != 0;
+
+    // ID, FEN, Moves, Moves1, Moves2, Material are special columns
     setupTagVec({
         "ID",
         "Event", "Site", "Date", "Round",
@@ -273,6 +360,9 @@ void Builder::setupTagVec(const std::vector<std::string>& tagVec, int optionFlag
     if (optionFlag & (create_flag_moves1 | create_flag_moves2)) {
         create_tagVec.push_back((optionFlag & create_flag_moves2) ? "Moves2" : "Moves1");
     }
+    if (create_materialColumn) {
+        create_tagVec.push_back("Material");
+    }
 }
 
 SQLite::Database* Builder::createDb(const std::string& path, int optionFlag, const std::vector<std::string>& tagVec, const std::string& dbDescription)
@@ -338,7 +428,7 @@ SQLite::Database* Builder::createDb(const std::string& path, int optionFlag, con
                     }
                     sql0 += "ID";
                     stype = "INTEGER";
-                } else if (str == "WhiteElo" || str == "BlackElo" || str == "PlyCount") {
+                } else if (str == "WhiteElo" || str == "BlackElo" || str == "PlyCount" || str == "Material") {
                     stype = "INTEGER";
                 } else if (str == "Moves1" || str == "Moves2") {
                     stype = "BLOB DEFAULT NULL";
@@ -353,6 +443,18 @@ SQLite::Database* Builder::createDb(const std::string& path, int optionFlag, con
         mDb->exec("DROP TABLE IF EXISTS Comments");
         mDb->exec("CREATE TABLE Comments (ID INTEGER PRIMARY KEY AUTOINCREMENT, GameID INTEGER, Ply INTEGER, Comment TEXT)");
 
+        // the index of Hash is created after adding all games
+        mDb->exec("DROP TABLE IF EXISTS Positions");
+        if (optionFlag & create_flag_positions) {
+            mDb->exec("CREATE TABLE Positions (Hash INTEGER, GameID INTEGER, Ply INTEGER)");
+        }
+
+        // the indexes of bands are created after adding all games too
+        mDb->exec("DROP TABLE IF EXISTS SimilarPositions");
+        if (optionFlag & create_flag_similar) {
+            mDb->exec(SimilarIndex::createTableString());
+        }
+
 
         mDb->exec("PRAGMA journal_mode=OFF");
 //        mDb->exec("PRAGMA synchronous=OFF");
@@ -673,18 +775,24 @@ void Builder::processPGNGameWithAThread(ThreadRecord* t, const std::unordered_ma
         // Parse moves
         if (paraRecord.optionFlag & (create_flag_moves1 | create_flag_moves2)) {
             //assert(t->board);
-            t->board->newGame(fenString);
+            t->board->_newGame(fenString);
 
             int flag = bslib::BoardCore::ParseMoveListFlag_quick_check;
             
+            // without comments, the moves and hash keys are all we need
             if (paraRecord.optionFlag & create_flag_discard_comments) {
-                flag |= bslib::BoardCore::ParseMoveListFlag_discardComment;
+                flag |= bslib::BoardCore::ParseMoveListFlag_discardComment
+                        | bslib::BoardCore::ParseMoveListFlag_compact_hist;
+            }
+
+            if (ecoString.empty() || (paraRecord.optionFlag & create_flag_reset_eco)) {
+                flag |= bslib::BoardCore::ParseMoveListFlag_eco;
             }
 
             bslib::PgnRecord record;
             record.moveText = moveText;
             record.gameID = gameID;
-            t->board->fromMoveList(&record, bslib::Notation::san, flag);
+            t->board->_fromMoveList(&record, bslib::Notation::san, flag, nullptr);
 
             plyCount = t->board->getHistListSize();
 
@@ -692,11 +800,20 @@ void Builder::processPGNGameWithAThread(ThreadRecord* t, const std::unordered_ma
                 return;
             }
 
+            if (create_materialColumn) {
+                t->insertGameStatement->bind(":Material", static_cast<long long>(t->board->_getMaterialSignature()));
+            }
+            if (create_positionTable) {
+                insertPositions(t, gameID);
+            }
+            if (create_similarTable) {
+                insertSimilarPositions(t, gameID);
+            }
+
             if (plyCount > 0) {
                 auto p = t->buf;
                 for(auto i = 0; i < plyCount; i++) {
-                    auto h = t->board->_getHistPointerAt(i);
-                    auto move = h->move;
+                    auto move = t->board->_getMoveAt(i);
                     
                     if (paraRecord.optionFlag & create_flag_moves2) { // 2 bytes encoding
                         *(int16_t*)p = bslib::ChessBoard::encode2Bytes(move);
@@ -715,7 +832,9 @@ void Builder::processPGNGameWithAThread(ThreadRecord* t, const std::unordered_ma
                         }
                     }
                     
-                    if (!h->comment.empty()) {
+                    // compact history has no comment
+                    auto h = t->board->_getHistPointerAt(i);
+                    if (h && !h->comment.empty()) {
                         t->insertCommentStatement->reset();
                         t->insertCommentStatement->bind(1, gameID);
                         t->insertCommentStatement->bind(2, i);
@@ -66,6 +66,12 @@ private:
 
     bool addNewField(const std::string& fieldName);
 
+protected:
+    void insertPositions(ThreadRecord* t, IDInteger gameID);
+    void createPositionIndex();
+    void insertSimilarPositions(ThreadRecord* t, IDInteger gameID);
+    void createSimilarIndex();
+
 public:
     static int standardizeFEN(char *fenBuf);
     static void standardizeDate(char* date);
@@ -89,6 +95,15 @@ protected:
     mutable std::mutex create_tagFieldMutex;
     std::unordered_map<std::string, int> create_tagMap;
 
+    // column Material keeps the material signature of games, for pruning when searching
+    bool create_materialColumn = false;
+
+    // table Positions keeps hash keys of all positions of games, for finding FENs
+    bool create_positionTable = false;
+
+    // table SimilarPositions keeps band keys of positions, for finding similar positions
+    bool create_similarTable = false;
+
 private:
     mutable std::mutex transactionMutex;
     const int TransactionCommit = 256 * 1024;
@@ -34,6 +34,17 @@ void Core::run(const ocgdb::ParaRecord& param)
     printOut.init((param.optionFlag & query_flag_print_all) && (param.optionFlag & query_flag_print_pgn), param.reportPath);
 
     paraRecord = param;
+    cancelled = false;
+
+    // only querying can report partial results, other tasks must not stop
+    // halfway silently (such as exporting or removing duplicates)
+    if (paraRecord.timeLimit > 0 && paraRecord.task != Task::query && paraRecord.task != Task::bench) {
+        std::cout << "Warning: -timeout works with querying only, ignored" << std::endl;
+        paraRecord.timeLimit = 0;
+    }
+    if (paraRecord.timeLimit > 0) {
+        deadline = getNow() + std::chrono::milliseconds(paraRecord.timeLimit);
+    }
     createPool();
 
     runTask();
@@ -47,6 +58,16 @@ std::chrono::steady_clock::time_point Core::getNow()
     return std::chrono::steady_clock::now();
 }
 
+/// Readers check it for each game, threads too before processing a game.
+/// Once it is set, all pending games are dropped
+bool Core::isCancelled()
+{
+    if (!cancelled && paraRecord.timeLimit > 0 && getNow() >= deadline) {
+        cancelled = true;
+    }
+    return cancelled;
+}
+
 void Core::createPool()
 {
     auto cpu = paraRecord.cpuNumber;
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <unordered_map>
+#include <atomic>
 
 #include "3rdparty/threadpool/thread_pool.hpp"
 
@@ -37,7 +38,11 @@ protected:
 
     void createPool();
     virtual void printStats() const;
+
+    /// Write results kept by threads, called when all tasks are done
+    virtual void flushResults() {}
     static std::chrono::steady_clock::time_point getNow();
+    bool isCancelled();
 
 protected:
     bslib::ChessVariant chessVariant = bslib::ChessVariant::standard;
@@ -54,7 +59,12 @@ protected:
 
     /// For stats
     std::chrono::steady_clock::time_point startTime;
-    int64_t blockCnt, processedPgnSz, processedCnt, workingGameIdx, errCnt, succCount;
+    int64_t blockCnt, processedPgnSz, processedCnt, workingGameIdx, errCnt;
+    std::atomic<int64_t> succCount;
+
+    /// Cancellation token, set when the time limit is over
+    std::atomic<bool> cancelled { false };
+    std::chrono::steady_clock::time_point deadline;
 };
 
 } // namespace ocdb
@@ -8,6 +8,11 @@
  * or copy at http://opensource.org/licenses/MIT)
  */
 
+#include <map>
+#include <set>
+#include <atomic>
+#include <algorithm>
+
 #include "3rdparty/SQLiteCpp/VariadicBind.h"
 #include "3rdparty/sqlite3/sqlite3.h"
 
@@ -15,13 +20,17 @@
 
 using namespace ocgdb;
 
-const std::string DbRead::fullGameQueryString =
-    "SELECT e.Name Event, s.Name Site, w.Name White, b.Name Black, g.* " \
+// Games with names of players, events, sites, as a derived table thus columns
+// of Games in an SQL predicate (-where) are not ambiguous with ones of other tables
+const std::string DbRead::gameWithNamesTableString =
+    "(SELECT e.Name Event, s.Name Site, w.Name White, b.Name Black, g.* " \
     "FROM Games g " \
     "INNER JOIN Players w ON WhiteID = w.ID " \
     "INNER JOIN Players b ON BlackID = b.ID " \
     "INNER JOIN Events e ON EventID = e.ID " \
-    "INNER JOIN Sites s ON SiteID = s.ID";
+    "INNER JOIN Sites s ON SiteID = s.ID) g";
+
+const std::string DbRead::fullGameQueryString = "SELECT * FROM " + gameWithNamesTableString;
 
 const std::string DbRead::searchFieldNames[] = {
     "",
@@ -31,6 +40,10 @@ const std::string DbRead::searchFieldNames[] = {
 };
 
 
+/// The reader waits when the number of pending games reaches this number per thread,
+/// since the pool queue keeps a copy of every record
+static const int64_t MaxPendingGamesPerThread = 1024;
+
 const char* DbRead::tagNames[] = {
     "GameID", // Not real PGN tag, added for convernience
     
@@ -92,6 +105,18 @@ SearchField DbRead::getMoveField(SQLite::Database* db, bool* hashMoves)
     return searchField;
 }
 
+bool DbRead::hasField(SQLite::Database* db, const std::string& fieldName)
+{
+    assert(db);
+    SQLite::Statement stmt(*db, "PRAGMA table_info(Games)");
+    while (stmt.executeStep()) {
+        if (fieldName == stmt.getColumn(1).getText()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 
 
 void DbRead::extractHeader(SQLite::Statement& query, bslib::PgnRecord& record)
@@ -120,8 +145,8 @@ void DbRead::extractHeader(SQLite::Statement& query, bslib::PgnRecord& record)
             continue;
         }
 
-        // Ignore Moves, Moves1, Moves2
-        if (name == "Moves" || name == "Moves1" || name == "Moves2") {
+        // Ignore Moves, Moves1, Moves2, Material
+        if (name == "Moves" || name == "Moves1" || name == "Moves2" || name == "Material") {
             continue;
         }
         
@@ -272,77 +297,163 @@ bool DbRead::openDB(const std::string& dbPath)
     return true;
 }
 
-bool DbRead::readADb(const std::string& dbPath, const std::string& sqlString)
+/// Select the columns for replaying games only, the database must be opened already.
+/// Other columns, such as headers, are queried later by IDs when needed
+std::string DbRead::projectionQueryString() const
+{
+    auto moveName = DbRead::searchFieldNames[static_cast<int>(searchField)];
+    assert(!moveName.empty());
+
+    std::string str = "SELECT g.ID, g.FEN, g." + moveName;
+    if (paraRecord.limitLen) {
+        str += ", g.PlyCount";
+    }
+    for(auto && name : extraColumns) {
+        str += ", g." + name;
+    }
+
+    if (paraRecord.where.empty()) {
+        return str + " FROM Games g";
+    }
+
+    // names of players, events, sites could be used by -where
+    return str + " FROM " + gameWithNamesTableString;
+}
+
+/// Create indexes for columns of Games used in an SQL predicate, if they are not existent
+void DbRead::createIndexes(const std::string& dbPath, const std::string& where)
+{
+    // names of players, events, sites are selected via their IDs
+    static const std::map<std::string, std::string> aliasMap {
+        {"White", "WhiteID"}, {"Black", "BlackID"}, {"Event", "EventID"}, {"Site", "SiteID"}
+    };
+
+    try {
+        SQLite::Database db(dbPath, SQLite::OPEN_READWRITE);
+
+        std::set<std::string> fieldSet;
+        {
+            SQLite::Statement stmt(db, "PRAGMA table_info(Games)");
+            while (stmt.executeStep()) {
+                std::string fieldName = stmt.getColumn(1).getText();
+                if (fieldName != "ID" && fieldName != "FEN" && fieldName != "Material"
+                    && fieldName.find("Moves") != 0) {
+                    fieldSet.insert(fieldName);
+                }
+            }
+        }
+
+        // identifiers out of quotes
+        std::set<std::string> nameSet;
+        char quote = 0;
+        for(size_t i = 0; i < where.size(); i++) {
+            auto ch = where.at(i);
+            if (quote) {
+                if (ch == quote) quote = 0;
+                continue;
+            }
+            if (ch == '\'' || ch == '"') {
+                quote = ch;
+                continue;
+            }
+            if (isalpha(ch) || ch == '_') {
+                auto j = i;
+                for(; j < where.size() && (isalnum(where.at(j)) || where.at(j) == '_'); j++) {}
+                auto name = where.substr(i, j - i);
+                auto it = aliasMap.find(name);
+                nameSet.insert(it != aliasMap.end() ? it->second : name);
+                i = j - 1;
+            }
+        }
+
+        for(auto && name : nameSet) {
+            if (fieldSet.find(name) != fieldSet.end()) {
+                db.exec("CREATE INDEX IF NOT EXISTS Games_" + name + " ON Games (" + name + ")");
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Warning: can't create indexes for -where, " << e.what() << std::endl;
+    }
+}
+
+bool DbRead::readADb(const std::string& dbPath, const std::string& _sqlString)
 {
     if (!openDB(dbPath)) {
         return false;
     }
+
+    // add conditions, before ORDER BY if any
+    auto sqlString = _sqlString.empty() ? projectionQueryString() : _sqlString;
+    std::string where;
+    {
+        if (!paraRecord.where.empty()) {
+            where = "(" + paraRecord.where + ")";
+        }
+        if (!sqlWhere.empty()) {
+            where += where.empty() ? sqlWhere : " AND (" + sqlWhere + ")";
+        }
+
+        if (!where.empty()) {
+            auto p = sqlString.find(" ORDER BY ");
+            if (p == std::string::npos) {
+                sqlString += " WHERE " + where;
+            } else {
+                sqlString.insert(p, " WHERE " + where);
+            }
+
+            try {
+                SQLite::Statement statement(*mDb, sqlString);
+            } catch (std::exception& e) {
+                std::cerr << "Error: invalid SQL predicate, " << e.what() << std::endl;
+                closeDb();
+                return false;
+            }
+        }
+    }
+
+    // only for a valid predicate
+    if (!paraRecord.where.empty()) {
+        createIndexes(dbPath, paraRecord.where);
+    }
     
     for(auto && t : threadMap) {
         t.second.resetStats();
     }
 
-    auto moveName = DbRead::searchFieldNames[static_cast<int>(searchField)];
-    assert(!moveName.empty());
-    
-    int flag = bslib::BoardCore::ParseMoveListFlag_quick_check | bslib::BoardCore::ParseMoveListFlag_discardComment;
-    if (searchField == SearchField::moves1) {
-        flag |= bslib::BoardCore::ParseMoveListFlag_move_size_1_byte;
-    }
+    maxPendingCnt = static_cast<int64_t>(pool->get_thread_count()) * MaxPendingGamesPerThread;
+    pendingPeak = 0;
 
-    {
+    // the projection is read by all threads, each one with its own connection and ranges of IDs
+    if ((paraRecord.optionFlag & query_flag_partition) && !(paraRecord.optionFlag & query_flag_ordered)
+        && _sqlString.empty() && dbPath != ":memory:") {
+        auto rangeString = projectionQueryString() + " WHERE "
+                            + (where.empty() ? "" : "(" + where + ") AND ")
+                            + "g.ID BETWEEN ? AND ?";
+        readPartitions(dbPath, rangeString);
+        printStats();
+    } else {
         SQLite::Statement statement(*mDb, sqlString);
         
         for (gameCnt = 0; statement.executeStep(); ++gameCnt) {
-            if (paraRecord.limitLen) {
-                auto c = statement.getColumn("PlyCount");
-                if (!c.isNull() && c.getInt() < paraRecord.limitLen) {
-                    continue;
-                }
-            }
-
             bslib::PgnRecord record;
-
-            record.gameID = statement.getColumn("ID").getInt();
-            record.fenText = statement.getColumn("FEN").getText();
             std::vector<int8_t> moveVec;
-
-            if (searchField == SearchField::moves) {
-                record.moveString = statement.getColumn("Moves").getText();
-                if (record.moveString.empty()) {
-                    continue;
-                }
-            } else {
-                auto c = statement.getColumn(moveName.c_str());
-                auto moveBlob = static_cast<const int8_t*>(c.getBlob());
-                
-                if (moveBlob) {
-                    auto sz = c.size();
-                    for(auto i = 0; i < sz; ++i) {
-                        moveVec.push_back(moveBlob[i]);
-                    }
-                }
-                
-                if (moveVec.empty()) {
-                    continue;
-                }
+            if (!extractRecord(statement, record, moveVec, _sqlString.empty())) {
+                continue;
             }
 
-            if (paraRecord.optionFlag & query_flag_print_pgn) {
-                DbRead::extractHeader(statement, record);
-            }
             threadProcessAGame(record, moveVec);
 
             if (gameCnt && (gameCnt & 0xffff) == 0) {
                 printStats();
             }
 
-            if (succCount >= paraRecord.resultNumberLimit) {
+            if (succCount >= paraRecord.resultNumberLimit || isCancelled()) {
                 break;
             }
         }
 
         pool->wait_for_tasks();
+        flushResults();
         printStats();
     }
 
@@ -366,6 +477,114 @@ bool DbRead::readADb(const std::string& dbPath, const std::string& sqlString)
     return true;
 }
 
+/// Copy the ID, FEN and moves of the current row of a statement into a record,
+/// return false if the game should be skipped
+bool DbRead::extractRecord(SQLite::Statement& statement, bslib::PgnRecord& record, std::vector<int8_t>& moveVec, bool projection) const
+{
+    if (paraRecord.limitLen) {
+        auto c = statement.getColumn("PlyCount");
+        if (!c.isNull() && c.getInt() < paraRecord.limitLen) {
+            return false;
+        }
+    }
+
+    record.gameID = statement.getColumn("ID").getInt();
+    record.fenText = statement.getColumn("FEN").getText();
+
+    if (searchField == SearchField::moves) {
+        record.moveString = statement.getColumn("Moves").getText();
+        if (record.moveString.empty()) {
+            return false;
+        }
+    } else {
+        auto moveName = DbRead::searchFieldNames[static_cast<int>(searchField)];
+        auto c = statement.getColumn(moveName.c_str());
+        auto moveBlob = static_cast<const int8_t*>(c.getBlob());
+
+        if (moveBlob) {
+            moveVec.assign(moveBlob, moveBlob + c.size());
+        }
+
+        if (moveVec.empty()) {
+            return false;
+        }
+    }
+
+    // the projection has no header
+    if ((paraRecord.optionFlag & query_flag_print_pgn) && !projection) {
+        DbRead::extractHeader(statement, record);
+    }
+    if (projection) {
+        for(auto && name : extraColumns) {
+            auto c = statement.getColumn(name.c_str());
+            if (!c.isNull()) {
+                record.tags[name] = c.getText();
+            }
+        }
+    }
+    return true;
+}
+
+/// The range of IDs is split into chunks, threads take the next chunk whenever they
+/// finish one, thus the fast ones do more. Games are processed by the reading threads
+void DbRead::readPartitions(const std::string& dbPath, const std::string& rangeString)
+{
+    int64_t minID = 0, maxID = -1;
+    {
+        SQLite::Statement statement(*mDb, "SELECT min(ID), max(ID) FROM Games");
+        if (statement.executeStep() && !statement.getColumn(0).isNull()) {
+            minID = statement.getColumn(0).getInt64();
+            maxID = statement.getColumn(1).getInt64();
+        }
+    }
+
+    gameCnt = 0;
+    if (maxID < minID) {
+        return;
+    }
+
+    auto threadCount = static_cast<int64_t>(pool->get_thread_count());
+    auto chunkSize = std::max<int64_t>(1024, (maxID - minID) / (threadCount * 16) + 1);
+
+    std::atomic<int64_t> nextID(minID), readCnt(0);
+
+    for(int64_t i = 0; i < threadCount; i++) {
+        pool->push_task([&]() {
+            try {
+                SQLite::Database db(dbPath, SQLite::OPEN_READONLY);
+                SQLite::Statement statement(db, rangeString);
+
+                for(int64_t from; (from = nextID.fetch_add(chunkSize)) <= maxID; ) {
+                    statement.reset();
+                    statement.bind(1, static_cast<long long>(from));
+                    statement.bind(2, static_cast<long long>(from + chunkSize - 1));
+
+                    while (statement.executeStep()) {
+                        readCnt++;
+
+                        bslib::PgnRecord record;
+                        std::vector<int8_t> moveVec;
+                        if (extractRecord(statement, record, moveVec, true)) {
+                            processAGame(record, moveVec);
+                        }
+
+                        if (succCount >= paraRecord.resultNumberLimit || isCancelled()) {
+                            return;
+                        }
+                    }
+                }
+            } catch (std::exception& e) {
+                std::lock_guard<std::mutex> dolock(printMutex);
+                std::cerr << "Error: can't read " << dbPath << ", " << e.what() << std::endl;
+            }
+        });
+    }
+
+    pool->wait_for_tasks();
+    flushResults();
+    gameCnt = static_cast<IDInteger>(readCnt.load());
+}
+
 void doProcessAGame(DbRead* instance, const bslib::PgnRecord& record, const std::vector<int8_t>& moveVec)
 {
     assert(instance);
@@ -375,7 +594,34 @@ void doProcessAGame(DbRead* instance, const bslib::PgnRecord& record, const std:
 void DbRead::threadProcessAGame(const bslib::PgnRecord& record, const std::vector<int8_t>& moveVec)
 {
     assert(pool);
-    pool->submit(doProcessAGame, this, record, moveVec);
+
+    // when the window is full, wait until it is half empty
+    auto pendingCnt = pendingGameCount();
+    if (pendingCnt >= maxPendingCnt) {
+        while (pendingGameCount() > maxPendingCnt / 2) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        pendingCnt = pendingGameCount();
+    }
+
+    // including this game, never above the window
+    pendingPeak = std::max(pendingPeak, pendingCnt + 1);
+
+    submittingAGame(record.gameID);
+    pool->push_task(doProcessAGame, this, record, moveVec);
+}
+
+int64_t DbRead::pendingGameCount() const
+{
+    return static_cast<int64_t>(pool->get_tasks_total());
+}
+
+void DbRead::printStats() const
+{
+    DbCore::printStats();
+    if (pendingPeak > 0) {
+        std::cout << ", peak queue: " << pendingPeak;
+    }
 }
 
 
@@ -29,6 +29,9 @@ protected:
 
 public:
     static SearchField getMoveField(SQLite::Database* db, bool* hashMoves = nullptr);
+    static bool hasField(SQLite::Database* db, const std::string& fieldName);
+    static void createIndexes(const std::string& dbPath, const std::string& where);
+    std::string projectionQueryString() const;
 
     static void extractHeader(SQLite::Statement& query, bslib::PgnRecord& record);
     static void queryForABoard( bslib::PgnRecord& record,
@@ -37,9 +40,11 @@ public:
                                 SQLite::Statement* queryComments,
                                 bslib::BoardCore* board);
     
+    /// sqlString is empty for reading only the columns needed to replay games
     virtual bool readADb(const std::string& dbPath, const std::string& sqlString);
 
 public:
+    static const std::string gameWithNamesTableString;
     static const std::string fullGameQueryString;
     static const std::string searchFieldNames[];
     static const char* tagNames[];
@@ -48,21 +53,37 @@ protected:
     virtual bool openDB(const std::string& dbPath);
     virtual void closeDb();
 
+    virtual void printStats() const override;
+
+    /// Called by the reader before a game is submitted to the pool, games are submitted in the reading order
+    virtual void submittingAGame(int /*gameID*/) {}
+
+    /// Number of games counted into the window of the reader
+    virtual int64_t pendingGameCount() const;
+
     static void printGamePGNByIDs(SQLite::Database& db, const std::vector<int>& gameIDVec, SearchField);
     
     static void printGamePGNByIDs(QueryGameRecord&, const std::vector<int>&);
 
 
-protected:
-    std::function<bool(const std::vector<uint64_t>&, const bslib::BoardCore*, const bslib::PgnRecord*)> checkToStop = nullptr;
-    std::function<bool(const bslib::BoardCore*, const bslib::PgnRecord*)> boardCallback = nullptr;
-
 private:
     void threadProcessAGame(const bslib::PgnRecord& record, const std::vector<int8_t>& moveVec);
+    bool extractRecord(SQLite::Statement& statement, bslib::PgnRecord& record, std::vector<int8_t>& moveVec, bool projection) const;
+    void readPartitions(const std::string& dbPath, const std::string& rangeString);
+
+protected:
+    // an extra condition for the query of readADb, set when opening the database
+    std::string sqlWhere;
+
+    // more columns of Games read by the projection into tags of records, set when opening the database
+    std::vector<std::string> extraColumns;
 
 private:
     QueryGameRecord* qgr = nullptr;
 
+    // bounded window of games submitted to the pool but not processed yet
+    int64_t maxPendingCnt = 0, pendingPeak = 0;
+
 };
 
 } // namespace ocdb
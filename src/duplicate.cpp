@@ -67,11 +67,13 @@ void Duplicate::runTask()
             flag |= bslib::BoardCore::ParseMoveListFlag_move_size_1_byte;
         }
 
-        std::string sqlString = "SELECT ID, FEN, PlyCount, " + moveName + " FROM Games";
+        // names of players, events, sites could be used by -where
+        std::string sqlString = "SELECT g.ID, g.FEN, g.PlyCount, g." + moveName + " FROM "
+                                + (paraRecord.where.empty() ? "Games g" : gameWithNamesTableString);
 
         // sort games by lengths thus the longer games can check back sorter ones for embeded games
         if (paraRecord.optionFlag & dup_flag_embededgames) {
-            sqlString += " ORDER BY PlyCount ASC";
+            sqlString += " ORDER BY g.PlyCount ASC";
         }
         
         readADb(dbPath, sqlString);
@@ -86,7 +88,7 @@ void Duplicate::printStats() const
         delCnt += t.second.delCnt;
     }
 
-    DbCore::printStats();
+    DbRead::printStats();
     std::cout << ", #duplicates: " << dupCnt << ", #removed: " << delCnt;
     std::cout << std::endl;
 }
@@ -101,17 +103,19 @@ void Duplicate::processAGameWithAThread(ThreadRecord* t, const bslib::PgnRecord&
     }
     assert(t->board);
 
-    t->board->newGame(record.fenText);
+    t->board->_newGame(record.fenText);
 
-    int flag = bslib::BoardCore::ParseMoveListFlag_quick_check;
+    int flag = bslib::BoardCore::ParseMoveListFlag_quick_check
+                | bslib::BoardCore::ParseMoveListFlag_discardComment
+                | bslib::BoardCore::ParseMoveListFlag_compact_hist;
     if (searchField == SearchField::moves) { // there is a text move only
-        t->board->fromMoveList(&record, bslib::Notation::san, flag, nullptr);
+        t->board->_fromMoveList(&record, bslib::Notation::san, flag, nullptr);
     } else {
         if (searchField == SearchField::moves1) {
             flag |= bslib::BoardCore::ParseMoveListFlag_move_size_1_byte;
         }
 
-        t->board->fromMoveList(&record, moveVec, flag, nullptr);
+        t->board->_fromMoveList(&record, moveVec, flag, nullptr);
     }
 
     t->gameCnt++;
@@ -194,7 +198,7 @@ void Duplicate::processAGameWithAThread(ThreadRecord* t, const bslib::PgnRecord&
             }
 
             record2.gameID = dupID;
-            t->board2->newGame(record2.fenText);
+            t->board2->_newGame(record2.fenText);
 
             if (searchField == SearchField::moves) {
                 record2.moveString = t->getGameStatement->getColumn("Moves").getText();
@@ -202,7 +206,7 @@ void Duplicate::processAGameWithAThread(ThreadRecord* t, const bslib::PgnRecord&
                     continue;
                 }
 
-                t->board2->fromMoveList(&record2, bslib::Notation::san, flag, nullptr);
+                t->board2->_fromMoveList(&record2, bslib::Notation::san, flag, nullptr);
             } else {
                 std::vector<int8_t> moveVec;
 
@@ -216,7 +220,7 @@ void Duplicate::processAGameWithAThread(ThreadRecord* t, const bslib::PgnRecord&
                     }
                 }
 
-                t->board2->fromMoveList(&record2, moveVec, flag, nullptr);
+                t->board2->_fromMoveList(&record2, moveVec, flag, nullptr);
             }
         }
 
@@ -445,14 +445,14 @@ void Builder::processPGNGameWithAThread_EPD(ThreadRecord* t, const std::unordere
         return;
     }
 
-    t->board->newGame(fenString);
+    t->board->_newGame(fenString);
 
     int flag = bslib::BoardCore::ParseMoveListFlag_quick_check;
 
     bslib::PgnRecord record;
     record.moveText = moveText;
     record.gameID = -1;
-    t->board->fromMoveList(&record, bslib::Notation::san, flag);
+    t->board->_fromMoveList(&record, bslib::Notation::san, flag, nullptr);
 
     auto plyCount = t->board->getHistListSize();
 
@@ -462,7 +462,7 @@ void Builder::processPGNGameWithAThread_EPD(ThreadRecord* t, const std::unordere
 
     std::vector<EPDRecord> v;
 
-    t->board2->newGame(fenString);
+    t->board2->_newGame(fenString);
     bslib::Hist hist;
     hist.comment = t->board->getFirstComment();
     auto r = process_addBoard_EPD(t->board2, &hist);
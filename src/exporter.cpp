@@ -47,7 +47,8 @@ void Exporter::runTask()
                     << "\nPGN path: " << pgnPath
                     << std::endl;
 
-        readADb(dbPath, DbRead::fullGameQueryString);
+        pgnOrder.clear();
+        readADb(dbPath, DbRead::fullGameQueryString + " ORDER BY g.ID");
     }
     
     pgnOfs.close();
@@ -65,8 +66,8 @@ void Exporter::processAGame(const bslib::PgnRecord& record, const std::vector<in
     }
     assert(t->board);
     
-    t->board->newGame(record.fenText);
-    t->board->fromMoveList(&record, moveVec, flag, nullptr);
+    t->board->_newGame(record.fenText);
+    t->board->_fromMoveList(&record, moveVec, flag, nullptr);
 
     if (t->queryComments) {
         t->queryComments->reset();
@@ -84,10 +85,22 @@ void Exporter::processAGame(const bslib::PgnRecord& record, const std::vector<in
         }
     }
 
+    // games are written in the order of their IDs
     auto toPgnString = t->board->toPgn(&record);
-    if (!toPgnString.empty()) {
-        std::lock_guard<std::mutex> dolock(pgnOfsMutex);
-        pgnOfs << toPgnString << "\n" << std::endl;
-    }
+    pgnOrder.complete(record.gameID, std::move(toPgnString), [this](std::string& str) {
+        if (!str.empty()) {
+            pgnOfs << str << "\n" << std::endl;
+        }
+    });
+}
 
+void Exporter::submittingAGame(int gameID)
+{
+    pgnOrder.submit(gameID);
+}
+
+/// games waiting for a slow game before them to be written are in the window too
+int64_t Exporter::pendingGameCount() const
+{
+    return pgnOrder.size();
 }
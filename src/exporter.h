@@ -25,10 +25,12 @@ private:
     virtual bool openDB(const std::string& dbPath) override;
     virtual void runTask() override;
 //    virtual void printStats() const override;
+    virtual void submittingAGame(int gameID) override;
+    virtual int64_t pendingGameCount() const override;
     
 private:
     int flag;
-    mutable std::mutex pgnOfsMutex;
+    ReorderBuffer<std::string> pgnOrder;
     std::ofstream pgnOfs;
 };
 
@@ -22,8 +22,34 @@ void Extract::getGame(const ParaRecord& _paraRecord)
 {
     paraRecord = _paraRecord;
 
+    if (paraRecord.dbPaths.empty()) {
+        for(auto && path : paraRecord.pgnPaths) {
+            getGameFromPgn(path);
+        }
+        return;
+    }
+
     SQLite::Database db(paraRecord.dbPaths.front(), SQLite::OPEN_READONLY);
     auto searchField = DbRead::getMoveField(&db);
 
     printGamePGNByIDs(db, paraRecord.gameIDVec, searchField);
 }
+
+/// Games are read directly by the index of the PGN file, it is built if missing or out of date
+void Extract::getGameFromPgn(const std::string& pgnPath)
+{
+    PgnIndex pgnIndex;
+    if (!pgnIndex.load(pgnPath, paraRecord.optionFlag & query_flag_pgn_index)) {
+        std::cerr << "Error: Can't open file: '" << pgnPath << "'" << std::endl;
+        return;
+    }
+
+    for(auto && gameID : paraRecord.gameIDVec) {
+        std::string str;
+        if (!pgnIndex.readGame(pgnPath, gameID, str)) {
+            std::cerr << "Error: there is no game ID " << gameID << " in " << pgnPath << std::endl;
+            continue;
+        }
+        printOut.printOut("\n\n;ID: " + std::to_string(gameID) + "\n" + str);
+    }
+}
@@ -12,6 +12,7 @@
 #define OCGDB_EXTRACT_H
 
 #include "dbread.h"
+#include "pgnread.h"
 
 namespace ocgdb {
 
@@ -24,6 +25,8 @@ public:
 private:
     virtual void runTask() override;
 
+    void getGameFromPgn(const std::string& pgnPath);
+
 };
 
 } // namespace ocdb
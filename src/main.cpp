@@ -18,6 +18,8 @@
 #include "builder.h"
 #include "extract.h"
 #include "addgame.h"
+#include "perft.h"
+#include "similar.h"
 
 #include "board/chess.h"
 
@@ -66,6 +68,21 @@ void runTask(ocgdb::ParaRecord& param)
             core = new ocgdb::AddGame;
             break;
         }
+        case ocgdb::Task::perft:
+        {
+            core = new ocgdb::Perft;
+            break;
+        }
+        case ocgdb::Task::similar:
+        {
+            core = new ocgdb::Similar;
+            break;
+        }
+        case ocgdb::Task::sancheck:
+        {
+            core = new ocgdb::SanCheck;
+            break;
+        }
 
         default:
             break;
@@ -105,6 +122,15 @@ int main(int argc, const char * argv[]) {
             paraRecord.task = ocgdb::Task::bench;
             continue;
         }
+        if (str == "-sancheck") {
+            if (oldTask != ocgdb::Task::none) {
+                errCnt++;
+                printConflictedTasks(oldTask, ocgdb::Task::sancheck);
+                break;
+            }
+            paraRecord.task = ocgdb::Task::sancheck;
+            continue;
+        }
         if (str == "-debug") {
             debugMode = true;
             continue;
@@ -128,6 +154,31 @@ int main(int argc, const char * argv[]) {
 
         if (i + 1 >= argc) continue;
 
+        if (str == "-perft") {
+            paraRecord.task = ocgdb::Task::perft;
+            paraRecord.perftFen = std::string(argv[++i]);
+            if (i + 1 < argc) {
+                paraRecord.perftDepth = std::atoi(argv[++i]);
+            }
+            if (oldTask != ocgdb::Task::none) {
+                errCnt++;
+                printConflictedTasks(oldTask, paraRecord.task);
+                break;
+            }
+            continue;
+        }
+
+        if (str == "-similar") {
+            paraRecord.task = ocgdb::Task::similar;
+            paraRecord.similarFen = std::string(argv[++i]);
+            if (oldTask != ocgdb::Task::none) {
+                errCnt++;
+                printConflictedTasks(oldTask, paraRecord.task);
+                break;
+            }
+            continue;
+        }
+
         if (str == "-pgn") {
             paraRecord.pgnPaths.push_back(std::string(argv[++i]));
             continue;
@@ -153,14 +204,27 @@ int main(int argc, const char * argv[]) {
             paraRecord.setupOptions(optionString);
             continue;
         }
+        if (str == "-agg") {
+            auto aggString = std::string(argv[++i]);
+            paraRecord.setupAggregates(aggString);
+            continue;
+        }
         if (str == "-plycount") {
             paraRecord.limitLen = std::atoi(argv[++i]);
             continue;
         }
+        if (str == "-where") {
+            paraRecord.where = std::string(argv[++i]);
+            continue;
+        }
         if (str == "-resultcount") {
             paraRecord.resultNumberLimit = std::atoi(argv[++i]);
             continue;
         }
+        if (str == "-timeout") {
+            paraRecord.timeLimit = std::atoll(argv[++i]);
+            continue;
+        }
         if (str == "-desc") {
             paraRecord.desc = std::string(argv[++i]);
             continue;
@@ -174,7 +238,8 @@ int main(int argc, const char * argv[]) {
                 paraRecord.task = ocgdb::Task::getgame;
                 paraRecord.gameIDVec.push_back(std::atoi(argv[++i]));
             }
-            if (oldTask != ocgdb::Task::none) {
+            // repeated -q or -g adds more queries or game IDs
+            if (oldTask != ocgdb::Task::none && oldTask != paraRecord.task) {
                 errCnt++;
                 printConflictedTasks(oldTask, paraRecord.task);
                 break;
@@ -218,7 +283,10 @@ void print_usage()
     " -dup                  check duplicate games in databases, works with -db\n" \
     " -export               export from a database into a PGN file, works with -db, -pgn\n" \
     " -bench                benchmarch querying games speed, works with -db\n" \
+    " -perft <fen> <depth>  validate and benchmark the move generator, use suite as fen for built-in positions\n" \
+    " -sancheck             resolve all SAN moves by both the current and the old resolver, print mismatches, works with -pgn\n" \
     " -q <query>            querying positions, repeat to add multi queries, works with -db, -pgn\n" \
+    " -similar <fen>        find positions similar to a FEN, needs table SimilarPositions, works with -db\n" \
     " -g <id>               get game with game ID numbers (repeat to add multi IDs), works with -db, -pgn\n" \
     " -pgn <file>           PGN game database file, repeat to add multi files\n" \
     " -db <file>            database file, extension should be .ocgdb.db3, repeat to add multi files\n" \
@@ -227,6 +295,13 @@ void print_usage()
     " -elo <n>              discard games with Elo under n (for creating)\n" \
     " -plycount <n>         discard games with ply-count under n (for creating)\n" \
     " -resultcount <n>      stop querying if the number of results above n (for querying)\n" \
+    "                       number of similar positions to print, default 100 (for -similar)\n" \
+    " -timeout <ms>         stop querying after ms milliseconds, print partial results (ignored by other tasks)\n" \
+    " -where \"<predicate>\"  an SQL predicate on table Games, such as \"WhiteElo > 2600 AND ECO LIKE 'B%'\"\n" \
+    "                       for reading databases (querying, exporting, checking duplicates)\n" \
+    " -agg [<fields>,]      count matched games by fields, separated by commas (for querying)\n" \
+    "    result, eco, year  results, ECO codes, years of the games\n" \
+    "    nextmove           moves played from the matched positions\n" \
     " -cpu <n>              number of threads, should <= total physical cores, omit it for using all cores\n" \
     " -desc \"<string>\"      a description to write to the table Info when creating a new database\n" \
     " -o [<options>,]       options, separated by commas\n" \
@@ -239,9 +314,16 @@ void print_usage()
     "    discardnoelo       discard games without player Elos (for creating)\n" \
     "    discardfen         discard games with FENs (not started from origin; for creating)\n" \
     "    reseteco           re-create all ECO (for creating)\n" \
+    "    positions          create table Positions for finding FENs quickly, needs moves1 or moves2 (for creating)\n" \
+    "    similar            create table SimilarPositions for finding similar positions, needs moves1 or moves2 (for creating)\n" \
+    "                       it is large, about 300 bytes per position, a database may grow 80 times\n" \
     "    printall           print all results (for querying, checking duplications)\n" \
     "    printfen           print FENs of results (for querying)\n" \
     "    printpgn           print simple PGNs of results (for querying)\n" \
+    "    partition          read databases by ranges of game IDs in all threads (for querying)\n" \
+    "    ordered            print results of databases in the order of games (for querying)\n" \
+    "    pgnindex           save indexes of games of PGN files as <file>.pgni next to them, for\n" \
+    "                       faster next queries and -g with -pgn; otherwise they are built every time\n" \
     "    embededgames       duplicate included games inside other games\n" \
     "    remove             remove duplicate games (for checking duplicates)\n" \
     "    nobot              Lichess: ignore BOT games (for creating a database)\n" \
@@ -250,10 +332,18 @@ void print_usage()
     "Examples:\n" \
     " ocgdb -create -pgn big.pgn -db big.ocgdb.db3 -cpu 4 -o moves\n" \
     " ocgdb -create -pgn big1.pgn -pgn big2.pgn -db :memory: -elo 2100 -o moves,moves1,discardsites\n" \
+    " ocgdb -create -pgn big.pgn -db big.ocgdb.db3 -cpu 4 -o moves2,positions\n" \
     " ocgdb -bench -db big.ocgdb.db3 -cpu 4\n" \
+    " ocgdb -db big.ocgdb.db3 -q \"Q = 3\" -where \"WhiteElo >= 2500 AND Date >= '2020'\"\n" \
+    " ocgdb -db big.ocgdb.db3 -q \"fen[rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2]\" -agg result,year,nextmove\n" \
+    " ocgdb -create -pgn big.pgn -db big.ocgdb.db3 -cpu 4 -o moves2,similar\n" \
+    " ocgdb -db big.ocgdb.db3 -similar \"r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3\" -resultcount 10 -o printfen\n" \
+    " ocgdb -perft suite 5\n" \
+    " ocgdb -sancheck -pgn big.pgn -cpu 4\n" \
     " ocgdb -db big.ocgdb.db3 -cpu 4 -q \"Q=3\" -q\"P[d4, e5, f4, g4] = 4 and kb7\"\n" \
     " ocgdb -db big.ocgdb.db3 -cpu 4 -q \"fen[K7/N7/k7/8/3p4/8/N7/8 w - - 0 1]\"\n" \
     " ocgdb -db big.ocgdb.db3 -g 423 -g 4432\n" \
+    " ocgdb -pgn big.pgn -g 423\n" \
     " ocgdb -db big.ocgdb.db3 -dup -o remove,printall\n" \
     " ocgdb -db big.ocgdb.db3 -dup -o remove -r report.txt\n"
     "\n" \
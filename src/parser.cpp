@@ -19,17 +19,8 @@
 #include "board/chess.h"
 #include "board/base.h"
 
-static int popCount(uint64_t x)
-{
-   int count = 0;
-   while (x) {
-       count++;
-       x &= x - 1; // reset LS1B
-   }
-   return count;
-}
-
 using namespace ocgdb;
+using bslib::popCount;
 
 static const std::unordered_map<std::string, Operator> string2operatorMap{
     {"and", Operator::op_and},
@@ -211,6 +202,24 @@ int Node::selectSquare(const std::string& from, const std::string& to)
 }
 
 
+/// Resolve the piece name and square set into bitboard indexes and a mask,
+/// thus evaluating is only two ANDs and a popCount
+void Node::resolvePiece()
+{
+    assert(nodeType == NodeType::piece && !string.empty());
+    auto ch = string.at(0);
+    colorIdx = typeIdx = static_cast<int>(ch == 'w' || isupper(ch) ? bslib::BBIdx::white : bslib::BBIdx::black);
+
+    // white, black: all pieces of that side
+    if (ch != 'w' && string != "black") {
+        auto type = bslib::Funcs::chessCharactorToPieceType(ch);
+        assert(type > bslib::EMPTY);
+        typeIdx = static_cast<int>(bslib::BBIdx::kings) + type - 1;
+    }
+
+    squareMask = hassquareset ? static_cast<uint64_t>(squareset) : ~0ULL;
+}
+
 bool Node::isValid() const
 {
     switch (nodeType) {
@@ -236,19 +245,19 @@ bool Node::isValid() const
     return false;
 }
 
-int Node::evaluate(const std::vector<uint64_t>& bitboardVec) const
+int Node::evaluate(const bslib::PositionBB& bitboards) const
 {
     switch (nodeType) {
         case NodeType::fen:
         {
             assert(!fenHashSet.empty());
-            auto hash = bitboardVec[static_cast<int>(bslib::BBIdx::hash)];
+            auto hash = bitboards[static_cast<int>(bslib::BBIdx::hash)];
             return isInFenHashSet(hash) ? 1 : 0;
         }
         case NodeType::op:
         {
             assert(lhs && rhs);
-            auto l = lhs->evaluate(bitboardVec), r = rhs->evaluate(bitboardVec);
+            auto l = lhs->evaluate(bitboards), r = rhs->evaluate(bitboards);
             switch (op) {
                 case Operator::op_and:
                     return (l && r) ? 1 : 0;
@@ -284,71 +293,7 @@ int Node::evaluate(const std::vector<uint64_t>& bitboardVec) const
             
         case NodeType::piece:
             assert(!lhs && !rhs);
-            
-            int64_t bb;
-            switch (string.at(0)) {
-                case 'w':
-                    assert(string == "white");
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::white)];
-                    break;
-
-                case 'K':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::white)] & bitboardVec[static_cast<int>(bslib::BBIdx::kings)];
-                    break;
-
-                case 'Q':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::white)] & bitboardVec[static_cast<int>(bslib::BBIdx::queens)];
-                    break;
-                case 'R':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::white)] & bitboardVec[static_cast<int>(bslib::BBIdx::rooks)];
-                    break;
-
-                case 'B':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::white)] & bitboardVec[static_cast<int>(bslib::BBIdx::bishops)];
-                    break;
-                case 'N':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::white)] & bitboardVec[static_cast<int>(bslib::BBIdx::knights)];
-                    break;
-                case 'P':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::white)] & bitboardVec[static_cast<int>(bslib::BBIdx::pawns)];
-                    break;
-
-                case 'k':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::black)] & bitboardVec[static_cast<int>(bslib::BBIdx::kings)];
-                    break;
-
-                case 'q':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::black)] & bitboardVec[static_cast<int>(bslib::BBIdx::queens)];
-                    break;
-                    
-                case 'r':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::black)] & bitboardVec[static_cast<int>(bslib::BBIdx::rooks)];
-                    break;
-
-                case 'b':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::black)];
-                    if (string == "b") {
-                        bb &= bitboardVec[static_cast<int>(bslib::BBIdx::bishops)];
-                    } else {
-                        assert(string == "black");
-                    }
-                    break;
-                case 'n':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::black)] & bitboardVec[static_cast<int>(bslib::BBIdx::knights)];
-                    break;
-                case 'p':
-                    bb = bitboardVec[static_cast<int>(bslib::BBIdx::black)] & bitboardVec[static_cast<int>(bslib::BBIdx::pawns)];
-                    break;
-
-                default:
-                    bb = 0;
-                    break;
-            }
-            
-            if (hassquareset) {
-                bb &= squareset;
-            }
-            return popCount(bb);
+            return popCount(bitboards[colorIdx] & bitboards[typeIdx] & squareMask);
             
         case NodeType::number:
             assert(number == std::atoi(string.c_str()));
@@ -357,19 +302,12 @@ int Node::evaluate(const std::vector<uint64_t>& bitboardVec) const
         case NodeType::pattern:
         {
             assert(!patternBitBoards.empty());
-            auto i = 0;
-            for(auto && patternVec : patternBitBoards) {
-                if (patternOperand == PatternOperand::greaterthan) {
-                    if (evaluate_pattern(bitboardVec, patternVec, PatternOperand::lessthan, patternTolerance)) {
-                        return 1;
-                    }
-                }
-                if (evaluate_pattern(patternVec, bitboardVec, patternOperand, patternTolerance)) {
-                    return 1;
-                }
-                i++;
+            if (patternOperand == PatternOperand::shift && !patternPieces.empty()) {
+                auto result = evaluate_pattern_shift(bitboards);
+                assert(result == evaluate_pattern_copies(bitboards));
+                return result;
             }
-            break;
+            return evaluate_pattern_copies(bitboards);
         }
 
         default:
@@ -379,7 +317,64 @@ int Node::evaluate(const std::vector<uint64_t>& bitboardVec) const
     return 0;
 }
 
-bool Node::evaluate_pattern(const std::vector<uint64_t>& bbSubVec, const std::vector<uint64_t>& bbSuperVec, PatternOperand operand, int tolerance) const
+/// Test the pattern and all its shifted copies one by one
+int Node::evaluate_pattern_copies(const bslib::PositionBB& bitboards) const
+{
+    for(auto && patternVec : patternBitBoards) {
+        if (patternOperand == PatternOperand::greaterthan) {
+            if (evaluate_pattern(bitboards, patternVec, PatternOperand::lessthan, patternTolerance)) {
+                return 1;
+            }
+        }
+        if (evaluate_pattern(patternVec, bitboards, patternOperand, patternTolerance)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// Test all shifts of the pattern together. Bit a of (bb >> offset) tells if the piece
+/// is there when the pattern is anchored at a, thus AND of them for all pieces
+/// are the anchors where the pattern is matched. With tolerance, the missing
+/// squares of each anchor are counted (by colors and by piece types, as evaluate_pattern)
+int Node::evaluate_pattern_shift(const bslib::PositionBB& bitboards) const
+{
+    auto tolerance = patternTolerance;
+    if (tolerance >= static_cast<int>(patternPieces.size())) {
+        return patternAnchorMask != 0;
+    }
+
+    auto anchors = patternAnchorMask;
+    if (tolerance == 0) {
+        for(auto && p : patternPieces) {
+            anchors &= (bitboards[p.colorIdx] & bitboards[p.typeIdx]) >> p.offset;
+            if (!anchors) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    // colorMiss[j], typeMiss[j]: anchors which have at least j + 1 missing squares
+    uint64_t colorMiss[64], typeMiss[64];
+    for(auto j = 0; j <= tolerance; j++) {
+        colorMiss[j] = typeMiss[j] = 0;
+    }
+
+    for(auto && p : patternPieces) {
+        auto c = ~(bitboards[p.colorIdx] >> p.offset), t = ~(bitboards[p.typeIdx] >> p.offset);
+        for(auto j = tolerance; j > 0; j--) {
+            colorMiss[j] |= colorMiss[j - 1] & c;
+            typeMiss[j] |= typeMiss[j - 1] & t;
+        }
+        colorMiss[0] |= c;
+        typeMiss[0] |= t;
+    }
+
+    return (anchors & ~colorMiss[tolerance] & ~typeMiss[tolerance]) != 0 ? 1 : 0;
+}
+
+bool Node::evaluate_pattern(const bslib::PositionBB& bbSubVec, const bslib::PositionBB& bbSuperVec, PatternOperand operand, int tolerance) const
 {
     auto blackSb = bbSubVec[static_cast<int>(bslib::BBIdx::black)], whiteSb = bbSubVec[static_cast<int>(bslib::BBIdx::white)];
     auto blackSp = bbSuperVec[static_cast<int>(bslib::BBIdx::black)], whiteSp = bbSuperVec[static_cast<int>(bslib::BBIdx::white)];
@@ -398,9 +393,9 @@ bool Node::evaluate_pattern(const std::vector<uint64_t>& bbSubVec, const std::ve
 
     if (cnt > tolerance) return false;
 
-    // check further, each position
+    // check further, each piece type (prop is not a square set)
     uint64_t d = 0;
-    for(auto idx = static_cast<int>(bslib::BBIdx::kings); idx < static_cast<int>(bslib::BBIdx::max); ++idx) {
+    for(auto idx = static_cast<int>(bslib::BBIdx::kings); idx < static_cast<int>(bslib::BBIdx::prop); ++idx) {
         auto sb = bbSubVec[idx], sp = bbSuperVec[idx];
 
         uint64_t dif;
@@ -447,11 +442,47 @@ void Node::pattern_shift()
             patternBitBoards.push_back(v2);
         }
     }
+
+    // the same as pieces with offsets from the lowest occupied square, which are
+    // the anchors of the copies since shifting keeps the order of squares
+    auto lowestSquare = [](const bslib::PositionBB& v) {
+        auto occupied = v[static_cast<int>(bslib::BBIdx::black)] | v[static_cast<int>(bslib::BBIdx::white)];
+        auto idx = 0;
+        while (!((occupied >> idx) & 1)) idx++;
+        return idx;
+    };
+
+    patternAnchorMask = 0;
+    for(auto && v2 : patternBitBoards) {
+        patternAnchorMask |= 1ULL << lowestSquare(v2);
+    }
+
+    patternPieces.clear();
+    auto anchor = lowestSquare(patternBitBoards.at(0));
+    auto v0 = patternBitBoards.at(0);
+    for(auto idx = anchor; idx < 64; idx++) {
+        auto b = 1ULL << idx;
+        PatternPiece p;
+        p.offset = idx - anchor;
+        if (v0[static_cast<int>(bslib::BBIdx::black)] & b) {
+            p.colorIdx = static_cast<int>(bslib::BBIdx::black);
+        } else if (v0[static_cast<int>(bslib::BBIdx::white)] & b) {
+            p.colorIdx = static_cast<int>(bslib::BBIdx::white);
+        } else {
+            continue;
+        }
+        for(auto i = static_cast<int>(bslib::BBIdx::kings); i <= static_cast<int>(bslib::BBIdx::pawns); i++) {
+            if (v0[i] & b) {
+                p.typeIdx = i;
+            }
+        }
+        patternPieces.push_back(p);
+    }
 }
 
-bool Node::pattern_shift_up(std::vector<uint64_t>& v)
+bool Node::pattern_shift_up(bslib::PositionBB& v)
 {
-    assert(!v.empty());
+    assert(v.isValid());
     auto bb = v[static_cast<int>(bslib::BBIdx::black)] | v[static_cast<int>(bslib::BBIdx::white)];
     assert(bb);
 
@@ -473,9 +504,9 @@ bool Node::pattern_shift_up(std::vector<uint64_t>& v)
     return true;
 }
 
-bool Node::pattern_shift_down(std::vector<uint64_t>& v)
+bool Node::pattern_shift_down(bslib::PositionBB& v)
 {
-    assert(!v.empty());
+    assert(v.isValid());
     auto bb = v[static_cast<int>(bslib::BBIdx::black)] | v[static_cast<int>(bslib::BBIdx::white)];
     assert(bb);
 
@@ -497,9 +528,9 @@ bool Node::pattern_shift_down(std::vector<uint64_t>& v)
     return true;
 }
 
-bool Node::pattern_shift_left(std::vector<uint64_t>& v)
+bool Node::pattern_shift_left(bslib::PositionBB& v)
 {
-    assert(!v.empty());
+    assert(v.isValid());
     auto bb = v[static_cast<int>(bslib::BBIdx::black)] | v[static_cast<int>(bslib::BBIdx::white)];
     assert(bb);
 
@@ -515,9 +546,9 @@ bool Node::pattern_shift_left(std::vector<uint64_t>& v)
     return true;
 }
 
-bool Node::pattern_shift_right(std::vector<uint64_t>& v)
+bool Node::pattern_shift_right(bslib::PositionBB& v)
 {
-    assert(!v.empty());
+    assert(v.isValid());
     auto bb = v[static_cast<int>(bslib::BBIdx::black)] | v[static_cast<int>(bslib::BBIdx::white)];
     assert(bb);
 
@@ -605,15 +636,836 @@ void Parser::printTree(const Node* node, std::string prefix) const
     printTree(node->rhs, prefix);
 }
 
-int Parser::evaluate(const std::vector<uint64_t>& bitboardVec) const
+int Parser::evaluate_tree(const bslib::PositionBB& bitboards) const
+{
+    return root && root->evaluate(bitboards);
+}
+
+int Parser::evaluate(const bslib::PositionBB& bitboards) const
+{
+    if (program.empty()) {
+        return evaluate_tree(bitboards);
+    }
+
+    auto result = execute(program, bitboards) != 0 ? 1 : 0;
+    assert(result == evaluate_tree(bitboards));
+    return result;
+}
+
+/// Evaluate positions of the batch together, return the index of the first
+/// matched one or -1 if none
+int Parser::evaluateBatch(const bslib::PositionBatch& batch) const
+{
+    if (batchProgram.empty()) {
+        return evaluateEach(batch);
+    }
+
+    auto result = executeBatch(batchProgram, batch);
+    assert(result == evaluateEach(batch));
+    return result;
+}
+
+int Parser::evaluateEach(const bslib::PositionBatch& batch) const
+{
+    bslib::PositionBB bitboards;
+    for(auto k = 0; k < batch.size; k++) {
+        batch.get(k, bitboards);
+        if (evaluate(bitboards)) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/// Piece counts and pawn advances are irreversible. When the bounds fail,
+/// the query can't be matched by any later position of the game
+bool Parser::isPossible(const bslib::PositionBB& bitboards) const
+{
+    return boundProgram.empty() || execute(boundProgram, bitboards) != 0;
+}
+
+int Parser::execute(const std::vector<Instruction>& program, const bslib::PositionBB& bitboards)
+{
+    int regs[MaxRegisters];
+    for(size_t pc = 0, n = program.size(); pc < n; ++pc) {
+        const auto& ins = program[pc];
+        auto& r = regs[ins.dst];
+
+        switch (ins.code) {
+            case OpCode::piece:
+                r = popCount(bitboards[ins.bbIdx0] & bitboards[ins.bbIdx1] & ins.mask);
+                break;
+            case OpCode::piece_eq:
+                r = popCount(bitboards[ins.bbIdx0] & bitboards[ins.bbIdx1] & ins.mask) == ins.number ? 1 : 0;
+                break;
+            case OpCode::piece_l:
+                r = popCount(bitboards[ins.bbIdx0] & bitboards[ins.bbIdx1] & ins.mask) < ins.number ? 1 : 0;
+                break;
+            case OpCode::piece_le:
+                r = popCount(bitboards[ins.bbIdx0] & bitboards[ins.bbIdx1] & ins.mask) <= ins.number ? 1 : 0;
+                break;
+            case OpCode::piece_g:
+                r = popCount(bitboards[ins.bbIdx0] & bitboards[ins.bbIdx1] & ins.mask) > ins.number ? 1 : 0;
+                break;
+            case OpCode::piece_ge:
+                r = popCount(bitboards[ins.bbIdx0] & bitboards[ins.bbIdx1] & ins.mask) >= ins.number ? 1 : 0;
+                break;
+            case OpCode::piece_ne:
+                r = popCount(bitboards[ins.bbIdx0] & bitboards[ins.bbIdx1] & ins.mask) != ins.number ? 1 : 0;
+                break;
+            case OpCode::piece_promotable:
+                r = popCount(bitboards[ins.bbIdx0] & (bitboards[ins.bbIdx1] | bitboards[static_cast<int>(bslib::BBIdx::pawns)]));
+                break;
+            case OpCode::pawn_reach:
+                r = std::min(popCount(bitboards[ins.bbIdx0] & bitboards[static_cast<int>(bslib::BBIdx::pawns)] & ins.mask), ins.number);
+                break;
+            case OpCode::number:
+                r = ins.number;
+                break;
+            case OpCode::node:
+                r = ins.node->evaluate(bitboards);
+                break;
+
+            case OpCode::add:
+                r += regs[ins.dst + 1];
+                break;
+            case OpCode::sub:
+                r -= regs[ins.dst + 1];
+                break;
+            case OpCode::multi:
+                r *= regs[ins.dst + 1];
+                break;
+            case OpCode::div:
+            {
+                auto d = regs[ins.dst + 1];
+                r = d != 0 ? r / d : 0;
+                break;
+            }
+
+            case OpCode::eq:
+                r = r == regs[ins.dst + 1] ? 1 : 0;
+                break;
+            case OpCode::l:
+                r = r < regs[ins.dst + 1] ? 1 : 0;
+                break;
+            case OpCode::le:
+                r = r <= regs[ins.dst + 1] ? 1 : 0;
+                break;
+            case OpCode::g:
+                r = r > regs[ins.dst + 1] ? 1 : 0;
+                break;
+            case OpCode::ge:
+                r = r >= regs[ins.dst + 1] ? 1 : 0;
+                break;
+            case OpCode::ne:
+                r = r != regs[ins.dst + 1] ? 1 : 0;
+                break;
+
+            case OpCode::boolean:
+                r = r != 0 ? 1 : 0;
+                break;
+            case OpCode::logic_and:
+                r = (r && regs[ins.dst + 1]) ? 1 : 0;
+                break;
+            case OpCode::logic_or:
+                r = (r || regs[ins.dst + 1]) ? 1 : 0;
+                break;
+            case OpCode::jump_zero:
+                if (r == 0) {
+                    pc = ins.number - 1;
+                }
+                break;
+            case OpCode::jump_nonzero:
+                if (r != 0) {
+                    pc = ins.number - 1;
+                }
+                break;
+        }
+    }
+
+    return regs[0];
+}
+
+/// Each instruction is a loop over all lanes of the batch with the same operation,
+/// simple enough for compilers to vectorize (SSE/AVX/NEON, depending on the target).
+/// Lanes after the batch size are computed too (with old values) but never used
+int Parser::executeBatch(const std::vector<Instruction>& program, const bslib::PositionBatch& batch)
+{
+    const int n = bslib::PositionBatch::MaxSize;
+    alignas(64) int regs[MaxRegisters][n];
+
+    for(auto && ins : program) {
+        auto r = regs[ins.dst];
+        const auto r1 = regs[ins.dst + 1];
+        const auto b0 = batch.bb[ins.bbIdx0].data(), b1 = batch.bb[ins.bbIdx1].data();
+        const auto pawns = batch.bb[static_cast<int>(bslib::BBIdx::pawns)].data();
+        const auto mask = ins.mask;
+        const auto number = ins.number;
+
+        switch (ins.code) {
+            case OpCode::piece:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & b1[k] & mask);
+                break;
+            case OpCode::piece_eq:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & b1[k] & mask) == number;
+                break;
+            case OpCode::piece_l:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & b1[k] & mask) < number;
+                break;
+            case OpCode::piece_le:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & b1[k] & mask) <= number;
+                break;
+            case OpCode::piece_g:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & b1[k] & mask) > number;
+                break;
+            case OpCode::piece_ge:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & b1[k] & mask) >= number;
+                break;
+            case OpCode::piece_ne:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & b1[k] & mask) != number;
+                break;
+            case OpCode::piece_promotable:
+                for(auto k = 0; k < n; k++) r[k] = popCount(b0[k] & (b1[k] | pawns[k]));
+                break;
+            case OpCode::pawn_reach:
+                for(auto k = 0; k < n; k++) r[k] = std::min(popCount(b0[k] & pawns[k] & mask), number);
+                break;
+            case OpCode::number:
+                for(auto k = 0; k < n; k++) r[k] = number;
+                break;
+            case OpCode::node:
+            {
+                bslib::PositionBB bitboards;
+                for(auto k = 0; k < batch.size; k++) {
+                    batch.get(k, bitboards);
+                    r[k] = ins.node->evaluate(bitboards);
+                }
+                for(auto k = batch.size; k < n; k++) r[k] = 0;
+                break;
+            }
+
+            case OpCode::add:
+                for(auto k = 0; k < n; k++) r[k] += r1[k];
+                break;
+            case OpCode::sub:
+                for(auto k = 0; k < n; k++) r[k] -= r1[k];
+                break;
+            case OpCode::multi:
+                for(auto k = 0; k < n; k++) r[k] *= r1[k];
+                break;
+            case OpCode::div:
+                for(auto k = 0; k < n; k++) r[k] = r1[k] != 0 ? r[k] / r1[k] : 0;
+                break;
+
+            case OpCode::eq:
+                for(auto k = 0; k < n; k++) r[k] = r[k] == r1[k];
+                break;
+            case OpCode::l:
+                for(auto k = 0; k < n; k++) r[k] = r[k] < r1[k];
+                break;
+            case OpCode::le:
+                for(auto k = 0; k < n; k++) r[k] = r[k] <= r1[k];
+                break;
+            case OpCode::g:
+                for(auto k = 0; k < n; k++) r[k] = r[k] > r1[k];
+                break;
+            case OpCode::ge:
+                for(auto k = 0; k < n; k++) r[k] = r[k] >= r1[k];
+                break;
+            case OpCode::ne:
+                for(auto k = 0; k < n; k++) r[k] = r[k] != r1[k];
+                break;
+
+            case OpCode::boolean:
+                for(auto k = 0; k < n; k++) r[k] = r[k] != 0;
+                break;
+            case OpCode::logic_and:
+                for(auto k = 0; k < n; k++) r[k] = (r[k] != 0) & (r1[k] != 0);
+                break;
+            case OpCode::logic_or:
+                for(auto k = 0; k < n; k++) r[k] = (r[k] | r1[k]) != 0;
+                break;
+
+            default: // no jump in batch programs
+                assert(false);
+                break;
+        }
+    }
+
+    for(auto k = 0; k < batch.size; k++) {
+        if (regs[0][k]) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/// Collect hash keys if the query is only of FENs (by fen[] or joined by or),
+/// thus it could be answered by an index of positions
+bool Parser::getFenHashSet(std::set<uint64_t>& hashSet) const
+{
+    return root && getFenHashSet(root, hashSet);
+}
+
+bool Parser::getFenHashSet(const Node* node, std::set<uint64_t>& hashSet)
+{
+    assert(node);
+    if (node->nodeType == NodeType::fen) {
+        hashSet.insert(node->fenHashSet.begin(), node->fenHashSet.end());
+        return true;
+    }
+
+    return node->nodeType == NodeType::op && node->op == Operator::op_or
+        && getFenHashSet(node->lhs, hashSet) && getFenHashSet(node->rhs, hashSet);
+}
+
+/// An SQL condition on the material signature column which must be true for
+/// games having any position matched the query, empty if there is none.
+/// The signature keeps the maximum number of each piece type per side over the game
+std::string Parser::materialFilter(const std::string& columnName) const
+{
+    if (!root) {
+        return "";
+    }
+    auto str = materialCondition(root, columnName);
+    if (str.empty()) {
+        return "";
+    }
+    return "(" + columnName + " IS NULL OR " + str + ")";
+}
+
+std::string Parser::materialCondition(const Node* node, const std::string& columnName) const
+{
+    assert(node);
+
+    switch (node->nodeType) {
+        case NodeType::piece:
+        {
+            // a piece term as a condition means there is at least one
+            auto s = materialUpperBound(node, columnName);
+            return s.empty() ? "" : s + " > 0";
+        }
+
+        case NodeType::op:
+            break;
+
+        default:
+            return "";
+    }
+
+    assert(node->lhs && node->rhs);
+
+    if (node->op == Operator::op_and || node->op == Operator::op_or) {
+        auto s0 = materialCondition(node->lhs, columnName);
+        auto s1 = materialCondition(node->rhs, columnName);
+        if (node->op == Operator::op_and) {
+            if (s0.empty() || s1.empty()) {
+                return s0.empty() ? s1 : s0;
+            }
+            return "(" + s0 + " AND " + s1 + ")";
+        }
+        // any side without a condition could be matched by any game
+        if (s0.empty() || s1.empty()) {
+            return "";
+        }
+        return "(" + s0 + " OR " + s1 + ")";
+    }
+
+    auto op = node->op;
+    auto exprNode = node->lhs, numberNode = node->rhs;
+    if (exprNode->nodeType == NodeType::number) {
+        std::swap(exprNode, numberNode);
+        if (op == Operator::op_l) op = Operator::op_g;
+        else if (op == Operator::op_le) op = Operator::op_ge;
+        else if (op == Operator::op_g) op = Operator::op_l;
+        else if (op == Operator::op_ge) op = Operator::op_le;
+    }
+
+    if (numberNode->nodeType != NodeType::number) {
+        return "";
+    }
+
+    // only lower limits of counts can be checked with the maximum numbers
+    auto k = 0;
+    switch (op) {
+        case Operator::op_eq:
+        case Operator::op_ge:
+            k = numberNode->number;
+            break;
+        case Operator::op_g:
+            k = numberNode->number + 1;
+            break;
+        default:
+            return "";
+    }
+
+    if (k <= 0) {
+        return "";
+    }
+
+    auto s = materialUpperBound(exprNode, columnName);
+    return s.empty() ? "" : s + " >= " + std::to_string(k);
+}
+
+/// An SQL expression of the maximum value of an expression of piece terms, empty if unknown
+std::string Parser::materialUpperBound(const Node* node, const std::string& columnName) const
+{
+    assert(node);
+
+    switch (node->nodeType) {
+        case NodeType::number:
+            return std::to_string(node->number);
+
+        case NodeType::piece:
+        {
+            auto side = node->colorIdx == static_cast<int>(bslib::BBIdx::white) ? bslib::Side::white : bslib::Side::black;
+            auto fromType = bslib::KING, toType = bslib::PAWNSTD;
+
+            if (node->typeIdx != node->colorIdx) {
+                fromType = toType = node->typeIdx - static_cast<int>(bslib::BBIdx::kings) + bslib::KING;
+            }
+
+            std::string str;
+            for(auto type = fromType; type <= toType; type++) {
+                if (!str.empty()) {
+                    str += " + ";
+                }
+                str += "((" + columnName + " >> " + std::to_string(bslib::ChessBoard::materialSignatureShift(side, type)) + ") & 15)";
+            }
+            return fromType == toType ? str : "(" + str + ")";
+        }
+
+        case NodeType::op:
+            if (node->op == Operator::op_add) {
+                auto s0 = materialUpperBound(node->lhs, columnName);
+                auto s1 = materialUpperBound(node->rhs, columnName);
+                if (!s0.empty() && !s1.empty()) {
+                    return "(" + s0 + " + " + s1 + ")";
+                }
+            }
+            return "";
+
+        default:
+            return "";
+    }
+}
+
+bool Parser::compile()
+{
+    program.clear();
+    batchProgram.clear();
+    boundProgram.clear();
+    if (!root || !compile(program, root, 0, false)) {
+        program.clear();
+        return false;
+    }
+
+    if (!compile(batchProgram, root, 0, true)) {
+        batchProgram.clear();
+    }
+
+    if (hasBound(root) && !compileBound(root, 0)) {
+        boundProgram.clear();
+    }
+    return true;
+}
+
+/// Squares from which pawns of a side could reach any of given squares. A pawn
+/// advances one row each time, changing its column by one when capturing
+static uint64_t pawnSourceMask(uint64_t squareMask, bool white)
+{
+    uint64_t mask = 0;
+    for(auto pos = 0; pos < 64; pos++) {
+        if (!(squareMask & bslib::ChessBoard::_posToBitboard[pos])) {
+            continue;
+        }
+        auto row = pos / 8, col = pos % 8;
+        for(auto p = 0; p < 64; p++) {
+            auto d = white ? p / 8 - row : row - p / 8; // rows to go
+            if (d >= 0 && abs(p % 8 - col) <= d) {
+                mask |= bslib::ChessBoard::_posToBitboard[p];
+            }
+        }
+    }
+    return mask;
+}
+
+/// Expressions of piece terms and numbers, their maximum values could be computed
+/// from the current position
+bool Parser::hasUpperBound(const Node* node)
+{
+    assert(node);
+    switch (node->nodeType) {
+        case NodeType::number:
+        case NodeType::piece:
+            return true;
+        case NodeType::op:
+            return node->op == Operator::op_add && hasUpperBound(node->lhs) && hasUpperBound(node->rhs);
+        default:
+            return false;
+    }
+}
+
+/// Conditions which need some minimum numbers of pieces, such as R = 3, P[d4, e5] >= 2
+bool Parser::hasBound(const Node* node)
+{
+    assert(node);
+    switch (node->nodeType) {
+        case NodeType::piece:
+            return true;
+        case NodeType::op:
+            break;
+        default:
+            return false;
+    }
+
+    assert(node->lhs && node->rhs);
+    switch (node->op) {
+        case Operator::op_and:
+            return hasBound(node->lhs) || hasBound(node->rhs);
+        case Operator::op_or:
+            return hasBound(node->lhs) && hasBound(node->rhs);
+        case Operator::op_eq:
+        case Operator::op_ge:
+            return node->rhs->nodeType == NodeType::number && node->rhs->number > 0 && hasUpperBound(node->lhs);
+        case Operator::op_g:
+            return node->rhs->nodeType == NodeType::number && node->rhs->number >= 0 && hasUpperBound(node->lhs);
+        case Operator::op_le: // 3 <= R
+            return node->lhs->nodeType == NodeType::number && node->lhs->number > 0 && hasUpperBound(node->rhs);
+        case Operator::op_l:  // 2 < R
+            return node->lhs->nodeType == NodeType::number && node->lhs->number >= 0 && hasUpperBound(node->rhs);
+        default:
+            return false;
+    }
+}
+
+bool Parser::compileBound(const Node* node, int reg)
+{
+    assert(node && hasBound(node));
+    if (reg >= MaxRegisters - 1) {
+        return false;
+    }
+
+    Instruction ins;
+    ins.dst = reg;
+
+    if (node->nodeType == NodeType::piece) {
+        if (!compileUpperBound(node, reg)) {
+            return false;
+        }
+        ins.code = OpCode::boolean;
+        boundProgram.push_back(ins);
+        return true;
+    }
+
+    assert(node->nodeType == NodeType::op);
+
+    if (node->op == Operator::op_and || node->op == Operator::op_or) {
+        // and: a side without bounds could be true anyway
+        if (!hasBound(node->lhs)) {
+            return compileBound(node->rhs, reg);
+        }
+        if (!hasBound(node->rhs)) {
+            return compileBound(node->lhs, reg);
+        }
+
+        if (!compileBound(node->lhs, reg)) {
+            return false;
+        }
+        auto jumpIdx = boundProgram.size();
+        ins.code = node->op == Operator::op_and ? OpCode::jump_zero : OpCode::jump_nonzero;
+        boundProgram.push_back(ins);
+
+        if (!compileBound(node->rhs, reg)) {
+            return false;
+        }
+        boundProgram[jumpIdx].number = static_cast<int>(boundProgram.size());
+        return true;
+    }
+
+    // the expression must reach the number
+    auto exprNode = node->lhs, numberNode = node->rhs;
+    auto k = 0;
+    switch (node->op) {
+        case Operator::op_eq:
+        case Operator::op_ge:
+            k = numberNode->number;
+            break;
+        case Operator::op_g:
+            k = numberNode->number + 1;
+            break;
+        case Operator::op_le:
+            std::swap(exprNode, numberNode);
+            k = numberNode->number;
+            break;
+        default:
+            std::swap(exprNode, numberNode);
+            k = numberNode->number + 1;
+            break;
+    }
+
+    if (!compileUpperBound(exprNode, reg)) {
+        return false;
+    }
+
+    Instruction numberIns;
+    numberIns.code = OpCode::number;
+    numberIns.dst = reg + 1;
+    numberIns.number = k;
+    boundProgram.push_back(numberIns);
+
+    ins.code = OpCode::ge;
+    boundProgram.push_back(ins);
+    return true;
+}
+
+bool Parser::compileUpperBound(const Node* node, int reg)
+{
+    assert(node && hasUpperBound(node));
+    if (reg >= MaxRegisters - 1) {
+        return false;
+    }
+
+    Instruction ins;
+    ins.dst = reg;
+
+    switch (node->nodeType) {
+        case NodeType::number:
+            ins.code = OpCode::number;
+            ins.number = node->number;
+            boundProgram.push_back(ins);
+            return true;
+
+        case NodeType::piece:
+        {
+            // squares are not counted for pieces but pawns since they move anywhere
+            ins.code = OpCode::piece;
+            ins.bbIdx0 = node->colorIdx;
+            ins.bbIdx1 = node->typeIdx;
+
+            if (node->typeIdx == static_cast<int>(bslib::BBIdx::pawns)) {
+                if (node->hassquareset) {
+                    ins.code = OpCode::pawn_reach;
+                    ins.mask = pawnSourceMask(node->squareMask, node->colorIdx == static_cast<int>(bslib::BBIdx::white));
+                    ins.number = popCount(node->squareMask);
+                }
+            } else if (node->typeIdx > static_cast<int>(bslib::BBIdx::kings)) {
+                ins.code = OpCode::piece_promotable;
+            }
+            boundProgram.push_back(ins);
+            return true;
+        }
+
+        default:
+            break;
+    }
+
+    assert(node->nodeType == NodeType::op && node->op == Operator::op_add);
+    if (!compileUpperBound(node->lhs, reg) || !compileUpperBound(node->rhs, reg + 1)) {
+        return false;
+    }
+    ins.code = OpCode::add;
+    boundProgram.push_back(ins);
+    return true;
+}
+
+bool Parser::compilePieceComparison(std::vector<Instruction>& prog, const Node* node, int reg)
+{
+    assert(node && node->nodeType == NodeType::op);
+    auto op = node->op;
+    if (op < Operator::op_eq || op > Operator::op_ne) {
+        return false;
+    }
+
+    auto pieceNode = node->lhs, numberNode = node->rhs;
+    if (pieceNode->nodeType == NodeType::number && numberNode->nodeType == NodeType::piece) {
+        std::swap(pieceNode, numberNode);
+
+        // 3 < R is R > 3
+        switch (op) {
+            case Operator::op_l:
+                op = Operator::op_g;
+                break;
+            case Operator::op_le:
+                op = Operator::op_ge;
+                break;
+            case Operator::op_g:
+                op = Operator::op_l;
+                break;
+            case Operator::op_ge:
+                op = Operator::op_le;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (pieceNode->nodeType != NodeType::piece || numberNode->nodeType != NodeType::number) {
+        return false;
+    }
+
+    Instruction ins;
+    ins.dst = reg;
+    ins.bbIdx0 = pieceNode->colorIdx;
+    ins.bbIdx1 = pieceNode->typeIdx;
+    ins.mask = pieceNode->squareMask;
+    ins.number = numberNode->number;
+
+    switch (op) {
+        case Operator::op_eq:
+            ins.code = OpCode::piece_eq;
+            break;
+        case Operator::op_l:
+            ins.code = OpCode::piece_l;
+            break;
+        case Operator::op_le:
+            ins.code = OpCode::piece_le;
+            break;
+        case Operator::op_g:
+            ins.code = OpCode::piece_g;
+            break;
+        case Operator::op_ge:
+            ins.code = OpCode::piece_ge;
+            break;
+        default:
+            ins.code = OpCode::piece_ne;
+            break;
+    }
+
+    prog.push_back(ins);
+    return true;
+}
+
+/// Compile the tree into prog. Operands of and/or share the same register
+/// and the right one is skipped by a jump when the left one decides the result.
+/// When branchless, both operands are computed and combined, without any jump
+bool Parser::compile(std::vector<Instruction>& prog, const Node* node, int reg, bool branchless)
 {
-    return root && root->evaluate(bitboardVec);
+    if (!node || reg >= MaxRegisters - 1) {
+        return false;
+    }
+
+    Instruction ins;
+    ins.dst = reg;
+
+    switch (node->nodeType) {
+        case NodeType::piece:
+            ins.code = OpCode::piece;
+            ins.bbIdx0 = node->colorIdx;
+            ins.bbIdx1 = node->typeIdx;
+            ins.mask = node->squareMask;
+            prog.push_back(ins);
+            return true;
+
+        case NodeType::number:
+            ins.code = OpCode::number;
+            ins.number = node->number;
+            prog.push_back(ins);
+            return true;
+
+        case NodeType::fen:
+        case NodeType::pattern:
+            ins.code = OpCode::node;
+            ins.node = node;
+            prog.push_back(ins);
+            return true;
+
+        case NodeType::op:
+            break;
+
+        default:
+            return false;
+    }
+
+    // batches: both operands are evaluated for all positions, then combined
+    if (branchless && (node->op == Operator::op_and || node->op == Operator::op_or)) {
+        if (!compile(prog, node->lhs, reg, branchless) || !compile(prog, node->rhs, reg + 1, branchless)) {
+            return false;
+        }
+        ins.code = node->op == Operator::op_and ? OpCode::logic_and : OpCode::logic_or;
+        prog.push_back(ins);
+        return true;
+    }
+
+    if (node->op == Operator::op_and || node->op == Operator::op_or) {
+        if (!compile(prog, node->lhs, reg, branchless)) {
+            return false;
+        }
+
+        ins.code = OpCode::boolean;
+        if (node->op == Operator::op_or) {
+            prog.push_back(ins);
+        }
+
+        auto jumpIdx = prog.size();
+        Instruction jump = ins;
+        jump.code = node->op == Operator::op_and ? OpCode::jump_zero : OpCode::jump_nonzero;
+        prog.push_back(jump);
+
+        if (!compile(prog, node->rhs, reg, branchless)) {
+            return false;
+        }
+        prog.push_back(ins);
+        prog[jumpIdx].number = static_cast<int>(prog.size());
+        return true;
+    }
+
+    // fused: a piece term compared with a number, such as R = 3, P[d4, e5] = 2
+    if (compilePieceComparison(prog, node, reg)) {
+        return true;
+    }
+
+    if (!compile(prog, node->lhs, reg, branchless) || !compile(prog, node->rhs, reg + 1, branchless)) {
+        return false;
+    }
+
+    switch (node->op) {
+        case Operator::op_add:
+            ins.code = OpCode::add;
+            break;
+        case Operator::op_sub:
+            ins.code = OpCode::sub;
+            break;
+        case Operator::op_multi:
+            ins.code = OpCode::multi;
+            break;
+        case Operator::op_div:
+            ins.code = OpCode::div;
+            break;
+        case Operator::op_eq:
+            ins.code = OpCode::eq;
+            break;
+        case Operator::op_l:
+            ins.code = OpCode::l;
+            break;
+        case Operator::op_le:
+            ins.code = OpCode::le;
+            break;
+        case Operator::op_g:
+            ins.code = OpCode::g;
+            break;
+        case Operator::op_ge:
+            ins.code = OpCode::ge;
+            break;
+        case Operator::op_ne:
+            ins.code = OpCode::ne;
+            break;
+
+        default:
+            return false;
+    }
+
+    prog.push_back(ins);
+    return true;
 }
 
 bool Parser::parse(bslib::ChessVariant _variant, const char* s)
 {
     assert(s);
     deleteTree();
+    program.clear();
+    batchProgram.clear();
+    boundProgram.clear();
     error = ParseError::none;
     variant = _variant;
 
@@ -696,7 +1548,12 @@ bool Parser::parse(bslib::ChessVariant _variant, const char* s)
             error = ParseError::invalid;
         }
     }
-    
+
+    // the tree is still used if the query is too deep to compile
+    if (error == ParseError::none) {
+        compile();
+    }
+
     return error == ParseError::none;
 }
 
@@ -826,7 +1683,9 @@ Node* Parser::parse_pattern(size_t& from)
 
     auto node = new Node();
     node->nodeType = NodeType::pattern;
-    node->patternBitBoards.push_back(board->posToBitboards());
+    bslib::PositionBB bitboards;
+    board->posToBitboards(bitboards);
+    node->patternBitBoards.push_back(bitboards);
 
     node->patternOperand = patternOperand;
     node->patternTolerance = patternOperandDelta;
@@ -1046,6 +1905,7 @@ Node* Parser::parse_piece(size_t& from)
     if (from < lexVec.size()) {
         parse_squareset(node, from);
     }
+    node->resolvePiece();
     return node;
 }
 
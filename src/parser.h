@@ -75,6 +75,14 @@ enum class PatternOperand
     equal, lessthan, greaterthan, shift, none
 };
 
+/// A piece of a shifted pattern, with its bit index from the anchor (the lowest occupied square)
+class PatternPiece
+{
+public:
+    int offset = 0;
+    int colorIdx = 0, typeIdx = 0;
+};
+
 class Node
 {
 public:
@@ -82,7 +90,7 @@ public:
     Node(const LexWord& w);
 
     std::string toString() const;
-    int evaluate(const std::vector<uint64_t>& bitboardVec) const;
+    int evaluate(const bslib::PositionBB& bitboards) const;
     bool isValid() const;
 
     int selectSquare(const char*);
@@ -93,14 +101,17 @@ public:
     }
     
     void pattern_shift();
+    void resolvePiece();
 
 private:
-    bool evaluate_pattern(const std::vector<uint64_t>& bbVec0, const std::vector<uint64_t>& bbVec1, PatternOperand, int tolerance) const;
+    bool evaluate_pattern(const bslib::PositionBB& bbVec0, const bslib::PositionBB& bbVec1, PatternOperand, int tolerance) const;
+    int evaluate_pattern_copies(const bslib::PositionBB& bitboards) const;
+    int evaluate_pattern_shift(const bslib::PositionBB& bitboards) const;
 
-    bool pattern_shift_up(std::vector<uint64_t>&);
-    bool pattern_shift_down(std::vector<uint64_t>&);
-    bool pattern_shift_left(std::vector<uint64_t>&);
-    bool pattern_shift_right(std::vector<uint64_t>&);
+    bool pattern_shift_up(bslib::PositionBB&);
+    bool pattern_shift_down(bslib::PositionBB&);
+    bool pattern_shift_left(bslib::PositionBB&);
+    bool pattern_shift_right(bslib::PositionBB&);
 
 public:
     NodeType nodeType = NodeType::none;
@@ -114,15 +125,53 @@ public:
     bool hassquareset = false, negative = false;
     int64_t squareset = 0;
 
+    // resolved by resolvePiece when parsing
+    int colorIdx = 0, typeIdx = 0;
+    uint64_t squareMask = ~0ULL;
+
     int pieceType = -1;
     bslib::Side pieceSide = bslib::Side::none;
     std::set<int> locSet;
-    std::vector<std::vector<uint64_t>> patternBitBoards;
+    std::vector<bslib::PositionBB> patternBitBoards;
+
+    // shifted patterns, matched by all shifts at once: pieces and the anchor squares of all allowed shifts
+    std::vector<PatternPiece> patternPieces;
+    uint64_t patternAnchorMask = 0;
 
     PatternOperand patternOperand;
     int patternTolerance = 0;
 };
 
+/// Instructions of the compiled query. Each one works on a register (dst),
+/// binary operators use registers dst and dst + 1, the result is in dst
+enum class OpCode : uint8_t
+{
+    piece,          // r[dst] = popCount(bb[bbIdx0] & bb[bbIdx1] & mask)
+    piece_eq, piece_l, piece_le, piece_g, piece_ge, piece_ne, // r[dst] = popCount(...) op number
+    piece_promotable, // r[dst] = popCount(bb[bbIdx0] & (bb[bbIdx1] | bb[pawns])), pieces could be promoted
+    pawn_reach,     // r[dst] = min(popCount(bb[bbIdx0] & bb[pawns] & mask), number), pawns could reach squares
+    number,         // r[dst] = number
+    node,           // r[dst] = node->evaluate(), for FEN and pattern nodes
+    add, sub, multi, div,
+    eq, l, le, g, ge, ne,
+    boolean,        // r[dst] = r[dst] != 0
+    logic_and,      // r[dst] = r[dst] && r[dst + 1], and/or without jumps, for batches
+    logic_or,       // r[dst] = r[dst] || r[dst + 1]
+    jump_zero,      // if r[dst] == 0 goto number
+    jump_nonzero,   // if r[dst] != 0 goto number
+};
+
+class Instruction
+{
+public:
+    OpCode code;
+    int dst = 0;
+    int bbIdx0 = 0, bbIdx1 = 0;
+    uint64_t mask = ~0ULL;
+    int number = 0;
+    const Node* node = nullptr;
+};
+
 class Parser
 {
 public:
@@ -134,9 +183,14 @@ public:
     std::string getErrorString() const;
     void printError() const;
 
-    int evaluate(const std::vector<uint64_t>& bitboardVec) const;
+    int evaluate(const bslib::PositionBB& bitboards) const;
+    int evaluateBatch(const bslib::PositionBatch& batch) const;
+    bool isPossible(const bslib::PositionBB& bitboards) const;
     void printTree() const;
 
+    std::string materialFilter(const std::string& columnName) const;
+    bool getFenHashSet(std::set<uint64_t>& hashSet) const;
+
 private:
     void deleteTree();
     void deleteTree(Node* node) const;
@@ -160,6 +214,23 @@ private:
 
     void printTree(const Node* node, std::string prefix = "") const;
 
+    bool compile();
+    static bool compile(std::vector<Instruction>& prog, const Node* node, int reg, bool branchless);
+    static bool compilePieceComparison(std::vector<Instruction>& prog, const Node* node, int reg);
+    int evaluate_tree(const bslib::PositionBB& bitboards) const;
+    int evaluateEach(const bslib::PositionBatch& batch) const;
+    static int execute(const std::vector<Instruction>& program, const bslib::PositionBB& bitboards);
+    static int executeBatch(const std::vector<Instruction>& program, const bslib::PositionBatch& batch);
+
+    static bool hasBound(const Node* node);
+    static bool hasUpperBound(const Node* node);
+    bool compileBound(const Node* node, int reg);
+    bool compileUpperBound(const Node* node, int reg);
+
+    std::string materialCondition(const Node* node, const std::string& columnName) const;
+    std::string materialUpperBound(const Node* node, const std::string& columnName) const;
+    static bool getFenHashSet(const Node* node, std::set<uint64_t>& hashSet);
+
     static std::string getErrorString(ParseError error);
 
 private:
@@ -168,7 +239,18 @@ private:
 
     std::vector<LexWord> lexVec;
     Node* root = nullptr;
-    
+
+    /// the tree compiled into a flat program, evaluated without recursion
+    static const int MaxRegisters = 32;
+    std::vector<Instruction> program;
+
+    /// the same without jumps, for evaluating all positions of a batch together
+    std::vector<Instruction> batchProgram;
+
+    /// conditions which must be true for the query could be matched at the current
+    /// or later positions, empty if there is none
+    std::vector<Instruction> boundProgram;
+
     ParseError error = ParseError::none;
 };
 
@@ -0,0 +1,307 @@
+/**
+ * This file is part of Open Chess Game Database Standard.
+ *
+ * Copyright (c) 2021-2022 Nguyen Pham (github@nguyenpham)
+ * Copyright (c) 2021-2022 Developers
+ *
+ * Distributed under the MIT License (MIT) (See accompanying file LICENSE.txt
+ * or copy at http://opensource.org/licenses/MIT)
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#include "board/chess.h"
+#include "perft.h"
+
+using namespace ocgdb;
+
+/// Standard perft positions with their known node numbers from depth 1
+static const std::vector<std::pair<std::string, std::vector<uint64_t>>> perftSuite = {
+    {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        { 20, 400, 8902, 197281, 4865609, 119060324 }
+    },
+    {   // Kiwipete
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        { 48, 2039, 97862, 4085603, 193690690 }
+    },
+    {
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        { 14, 191, 2812, 43238, 674624, 11030083 }
+    },
+    {
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        { 6, 264, 9467, 422333, 15833292 }
+    },
+    {
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        { 44, 1486, 62379, 2103487, 89941194 }
+    },
+    {
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        { 46, 2079, 89890, 3894594, 164075551 }
+    },
+};
+
+/// Maximum number of positions used for measuring each board function
+static const size_t benchPositionLimit = 10000;
+
+/// Each board function is repeated several times per position to make timing stable
+static const int benchRepeat = 10;
+
+
+Perft::~Perft()
+{
+    if (board) {
+        delete board;
+        board = nullptr;
+    }
+}
+
+void Perft::runTask()
+{
+    std::cout << "Perft..." << std::endl;
+
+    board = bslib::Funcs::createBoard(chessVariant);
+
+    if (paraRecord.perftFen != "suite") {
+        if (perft(paraRecord.perftFen, paraRecord.perftDepth, std::vector<uint64_t>())) {
+            bench(paraRecord.perftFen, paraRecord.perftDepth);
+        }
+        return;
+    }
+
+    auto failedCnt = 0;
+    for(auto && p : perftSuite) {
+        auto depth = std::min(paraRecord.perftDepth, static_cast<int>(p.second.size()));
+        if (!perft(p.first, depth, p.second)) {
+            failedCnt++;
+            continue;
+        }
+        bench(p.first, depth);
+    }
+
+    std::cout << "Suite: " << perftSuite.size() << " positions, failed: " << failedCnt << std::endl;
+}
+
+bool Perft::perft(const std::string& fen, int depth, const std::vector<uint64_t>& expectedVec)
+{
+    std::cout << "\nFEN: " << fen << std::endl;
+
+    board->_newGame(fen);
+    if (!board->isValid()) {
+        std::cerr << "Error: invalid FEN" << std::endl;
+        return false;
+    }
+
+    auto ok = true;
+    for(auto d = 1; d <= depth; d++) {
+        auto start = getNow();
+        auto nodes = board->_perft(d);
+        int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(getNow() - start).count() + 1;
+
+        std::cout << "depth: " << d
+                  << ", nodes: " << nodes
+                  << ", elapsed: " << elapsed << "ms"
+                  << ", speed: " << nodes * 1000ULL / elapsed << " nodes/s";
+
+        if (static_cast<size_t>(d) <= expectedVec.size()) {
+            auto expected = expectedVec.at(d - 1);
+            if (nodes == expected) {
+                std::cout << ", OK";
+            } else {
+                std::cout << ", FAILED, expected: " << expected;
+                ok = false;
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    return ok;
+}
+
+/// Collect positions of the tree for measuring board functions
+void Perft::collectPositions(int depth, std::vector<std::string>& fenVec)
+{
+    if (fenVec.size() >= benchPositionLimit) {
+        return;
+    }
+
+    fenVec.push_back(board->getFen());
+    if (depth <= 0) {
+        return;
+    }
+
+    std::vector<bslib::MoveFull> moveList;
+    board->_genLegalOnly(moveList, board->side);
+
+    for(auto && move : moveList) {
+        board->_make(move);
+        collectPositions(depth - 1, fenVec);
+        board->_takeBack();
+    }
+}
+
+void Perft::bench(const std::string& fen, int depth)
+{
+    std::vector<std::string> fenVec;
+    board->_newGame(fen);
+    collectPositions(std::min(depth - 1, 3), fenVec);
+
+    std::chrono::steady_clock::duration genTime {}, makeTime {}, bitboardTime {}, sanTime {};
+    uint64_t genCnt = 0, makeCnt = 0, bitboardCnt = 0, sanCnt = 0;
+
+    std::vector<bslib::MoveFull> moveList, legalMoveList;
+    bslib::HistCompact hist;
+    bslib::PositionBB bitboards;
+
+    for(auto && s : fenVec) {
+        board->_newGame(s);
+
+        legalMoveList.clear();
+        board->_genLegalOnly(legalMoveList, board->side);
+
+        auto t0 = getNow();
+        for(auto i = 0; i < benchRepeat; i++) {
+            moveList.clear();
+            board->_gen(moveList, board->side);
+        }
+        auto t1 = getNow();
+        genCnt += moveList.size() * benchRepeat;
+
+        for(auto i = 0; i < benchRepeat; i++) {
+            for(auto && move : moveList) {
+                board->_make(move, hist);
+                board->_takeBack(hist);
+            }
+        }
+        auto t2 = getNow();
+        makeCnt += moveList.size() * benchRepeat;
+
+        for(auto i = 0; i < benchRepeat; i++) {
+            board->posToBitboards(bitboards);
+        }
+        auto t3 = getNow();
+        bitboardCnt += benchRepeat;
+
+        /// SAN needs the move in the history list, the cost of making is measured
+        /// by the next loop and subtracted
+        for(auto i = 0; i < benchRepeat; i++) {
+            for(auto && move : legalMoveList) {
+                board->_make(move);
+                board->createSanStringForLastMove();
+                board->_takeBack();
+            }
+        }
+        auto t4 = getNow();
+        for(auto i = 0; i < benchRepeat; i++) {
+            for(auto && move : legalMoveList) {
+                board->_make(move);
+                board->_takeBack();
+            }
+        }
+        auto t5 = getNow();
+        sanCnt += legalMoveList.size() * benchRepeat;
+
+        genTime += t1 - t0;
+        makeTime += t2 - t1;
+        bitboardTime += t3 - t2;
+        sanTime += (t4 - t3) - (t5 - t4);
+    }
+
+    auto speed = [](uint64_t cnt, std::chrono::steady_clock::duration d) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        return us > 0 ? cnt * 1000000ULL / static_cast<uint64_t>(us) : 0;
+    };
+
+    std::cout << "benchmark, #positions: " << fenVec.size() << "\n"
+              << "  _gen: " << speed(genCnt, genTime) << " moves/s\n"
+              << "  _make/_takeBack: " << speed(makeCnt, makeTime) << " moves/s\n"
+              << "  posToBitboards: " << speed(bitboardCnt, bitboardTime) << " positions/s\n"
+              << "  createSanStringForLastMove: " << speed(sanCnt, sanTime) << " moves/s"
+              << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////
+void SanCheck::runTask()
+{
+    std::cout << "Checking SAN resolvers..." << std::endl;
+
+    sanCnt = mismatchCnt = 0;
+
+    // game IDs of mismatches are the orders of games in the files
+    pgnIndexing = true;
+
+    for(auto && path : paraRecord.pgnPaths) {
+        startTime = getNow();
+        processPgnFile(path);
+        if (cancelled) {
+            break;
+        }
+    }
+
+    std::cout << "SAN moves: " << sanCnt << ", mismatches: " << mismatchCnt << std::endl;
+}
+
+void SanCheck::processPGNGameWithAThread(ThreadRecord* t, const std::unordered_map<char*, char*>& tagMap, const char* moveText)
+{
+    assert(t);
+    if (isCancelled()) {
+        return;
+    }
+
+    auto board = static_cast<bslib::ChessBoard*>(t->board);
+    if (!board) {
+        board = new bslib::ChessBoard(chessVariant);
+
+        // called before making the move, the board is at the position of the SAN
+        board->sanCrossCheckFunc = [this, t, board](const std::string& san, int from, int fromGen) {
+            sanCnt++;
+            if (from == fromGen) {
+                return;
+            }
+            mismatchCnt++;
+
+            auto squareString = [](int pos) {
+                return pos >= 0 ? bslib::Funcs::chessPosToCoordinateString(pos) : std::string("none");
+            };
+
+            std::lock_guard<std::mutex> dolock(printMutex);
+            std::cout << "Mismatch, gameId: " << t->pgnGameID
+                      << ", ply: " << board->getHistListSize() + 1
+                      << ", SAN: " << san
+                      << ", from: " << squareString(from)
+                      << ", old resolver: " << squareString(fromGen)
+                      << ", FEN: " << board->getFen() << std::endl;
+        };
+        t->board = board;
+    }
+
+    bslib::PgnRecord record;
+    record.gameID = t->pgnGameID;
+    record.moveText = moveText;
+
+    auto it = std::find_if(tagMap.begin(), tagMap.end(), [](const std::pair<char* const, char*>& p) {
+        return strcmp(p.first, "FEN") == 0;
+    });
+    if (it != tagMap.end()) {
+        record.fenText = it->second;
+    }
+
+    board->_newGame(record.fenText);
+
+    int flag = bslib::BoardCore::ParseMoveListFlag_quick_check
+                | bslib::BoardCore::ParseMoveListFlag_discardComment
+                | bslib::BoardCore::ParseMoveListFlag_compact_hist;
+    board->_fromMoveList(&record, bslib::Notation::san, flag, nullptr);
+
+    t->gameCnt++;
+}
+
+void SanCheck::printStats() const
+{
+    PGNRead::printStats();
+    std::cout << ", SAN moves: " << sanCnt << ", mismatches: " << mismatchCnt << std::endl;
+}
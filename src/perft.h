@@ -0,0 +1,52 @@
+/**
+ * This file is part of Open Chess Game Database Standard.
+ *
+ * Copyright (c) 2021-2022 Nguyen Pham (github@nguyenpham)
+ * Copyright (c) 2021-2022 Developers
+ *
+ * Distributed under the MIT License (MIT) (See accompanying file LICENSE.txt
+ * or copy at http://opensource.org/licenses/MIT)
+ */
+
+#ifndef OCGDB_PERFT_H
+#define OCGDB_PERFT_H
+
+#include "pgnread.h"
+
+namespace ocgdb {
+
+/// Validate and measure the board engine (move generator, make/take back,
+/// bitboards, SAN) without any database or PGN file
+class Perft : public Core
+{
+public:
+    virtual ~Perft();
+
+private:
+    virtual void runTask() override;
+
+    bool perft(const std::string& fen, int depth, const std::vector<uint64_t>& expectedVec);
+    void bench(const std::string& fen, int depth);
+    void collectPositions(int depth, std::vector<std::string>& fenVec);
+
+private:
+    bslib::BoardCore* board = nullptr;
+};
+
+
+/// Differential check of the SAN resolver: every SAN move of PGN files is resolved
+/// by both the current resolver and the old one (generating all moves), mismatches are printed
+class SanCheck : public PGNRead
+{
+private:
+    virtual void runTask() override;
+    virtual void processPGNGameWithAThread(ThreadRecord*, const std::unordered_map<char*, char*>&, const char *) override;
+    virtual void printStats() const override;
+
+private:
+    std::atomic<int64_t> sanCnt{0}, mismatchCnt{0};
+};
+
+} // namespace ocdb
+
+#endif /* OCGDB_PERFT_H */
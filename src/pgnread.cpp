@@ -8,10 +8,210 @@
  * or copy at http://opensource.org/licenses/MIT)
  */
 
+#include <algorithm>
+#include <filesystem>
+
 #include "pgnread.h"
 
 using namespace ocgdb;
 
+/// Games read by a thread at once when a PGN file is split by its index
+static const int pgnIndexChunkGames = 256;
+
+static const char pgnIndexMagic[4] = { 'P', 'G', 'N', 'I' };
+static const uint32_t pgnIndexVersion = 1;
+
+
+// the size and the modified time of the PGN file, the index is valid only if they are not changed
+static bool getPgnFileStamp(const std::string& pgnPath, uint64_t& size, int64_t& time)
+{
+    std::error_code ec;
+    auto path = std::filesystem::u8path(pgnPath);
+    size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    time = static_cast<int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    return !ec;
+}
+
+std::string PgnIndex::indexPath(const std::string& pgnPath)
+{
+    return pgnPath + ".pgni";
+}
+
+void PgnIndex::clear()
+{
+    offsets.clear();
+    prevCh = '\n';
+    matchLen = 0;
+    matchOffset = 0;
+}
+
+/// A game starts with the tag Event at the beginning of a line, the same as processDataBlock
+void PgnIndex::scan(const char* buffer, size_t sz, uint64_t blockOffset)
+{
+    static const char* pattern = "[Event";
+    static const int patternLen = 6;
+
+    for(size_t i = 0; i < sz; i++) {
+        char ch = buffer[i];
+
+        if (matchLen == patternLen) {
+            if (ch <= ' ') {
+                offsets.push_back(matchOffset);
+            }
+            matchLen = 0;
+        } else if (matchLen > 0) {
+            matchLen = ch == pattern[matchLen] ? matchLen + 1 : 0;
+        }
+
+        if (matchLen == 0 && ch == '[' && prevCh < ' ') {
+            matchLen = 1;
+            matchOffset = blockOffset + i;
+        }
+        prevCh = ch;
+    }
+}
+
+bool PgnIndex::build(const std::string& pgnPath)
+{
+    clear();
+
+    std::ifstream file(std::filesystem::u8path(pgnPath), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::vector<char> buffer(1024 * 1024);
+    uint64_t offset = 0;
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        auto k = static_cast<size_t>(file.gcount());
+        if (k == 0) {
+            break;
+        }
+        scan(buffer.data(), k, offset);
+        offset += k;
+    }
+    return true;
+}
+
+/// Read the index file if it is valid, otherwise scan the PGN file, then save it if required
+bool PgnIndex::load(const std::string& pgnPath, bool saving)
+{
+    if (read(pgnPath)) {
+        return true;
+    }
+    if (!build(pgnPath)) {
+        return false;
+    }
+
+    if (saving) {
+        if (write(pgnPath)) {
+            std::cout << "Created PGN index: '" << indexPath(pgnPath) << "', #games: " << offsets.size() << std::endl;
+        } else {
+            std::cerr << "Warning: can't write PGN index: '" << indexPath(pgnPath) << "'" << std::endl;
+        }
+    }
+    return true;
+}
+
+bool PgnIndex::read(const std::string& pgnPath)
+{
+    clear();
+
+    uint64_t pgnSize;
+    int64_t pgnTime;
+    if (!getPgnFileStamp(pgnPath, pgnSize, pgnTime)) {
+        return false;
+    }
+
+    std::ifstream file(std::filesystem::u8path(indexPath(pgnPath)), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t size = 0, cnt = 0;
+    int64_t time = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char*)&version, sizeof(version));
+    file.read((char*)&size, sizeof(size));
+    file.read((char*)&time, sizeof(time));
+    file.read((char*)&cnt, sizeof(cnt));
+
+    if (!file || memcmp(magic, pgnIndexMagic, sizeof(magic)) != 0 || version != pgnIndexVersion
+        || size != pgnSize || time != pgnTime || cnt > pgnSize) {
+        return false;
+    }
+
+    offsets.resize(static_cast<size_t>(cnt));
+    file.read((char*)offsets.data(), static_cast<std::streamsize>(cnt * sizeof(uint64_t)));
+    if (!file) {
+        offsets.clear();
+        return false;
+    }
+    return true;
+}
+
+bool PgnIndex::write(const std::string& pgnPath) const
+{
+    uint64_t pgnSize;
+    int64_t pgnTime;
+    if (!getPgnFileStamp(pgnPath, pgnSize, pgnTime)) {
+        return false;
+    }
+
+    std::ofstream file(std::filesystem::u8path(indexPath(pgnPath)), std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    uint64_t cnt = offsets.size();
+    file.write(pgnIndexMagic, sizeof(pgnIndexMagic));
+    file.write((const char*)&pgnIndexVersion, sizeof(pgnIndexVersion));
+    file.write((const char*)&pgnSize, sizeof(pgnSize));
+    file.write((const char*)&pgnTime, sizeof(pgnTime));
+    file.write((const char*)&cnt, sizeof(cnt));
+    file.write((const char*)offsets.data(), static_cast<std::streamsize>(cnt * sizeof(uint64_t)));
+    return static_cast<bool>(file);
+}
+
+bool PgnIndex::readGame(const std::string& pgnPath, int gameID, std::string& str) const
+{
+    if (gameID <= 0 || gameID > static_cast<int>(offsets.size())) {
+        return false;
+    }
+
+    std::ifstream file(std::filesystem::u8path(pgnPath), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    auto begin = offsets[gameID - 1];
+    auto end = gameID < static_cast<int>(offsets.size()) ? offsets[gameID] : bslib::Funcs::getFileSize(pgnPath);
+    if (end <= begin) {
+        return false;
+    }
+
+    str.resize(static_cast<size_t>(end - begin));
+    file.seekg(static_cast<std::streamoff>(begin));
+    file.read(&str[0], static_cast<std::streamsize>(str.size()));
+    if (!file) {
+        return false;
+    }
+
+    // trim the blank lines before the next game
+    while (!str.empty() && static_cast<unsigned char>(str.back()) <= ' ') {
+        str.pop_back();
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+
 // the game between two blocks, first half
 void PGNRead::processHalfBegin(char* buffer, long len)
 {
@@ -53,6 +253,13 @@ void PGNRead::processHalfEnd(char* buffer, long len)
 }
 
 void PGNRead::processDataBlock(char* buffer, long sz, bool connectBlock)
+{
+    parseDataBlock(buffer, sz, connectBlock, [this](const std::unordered_map<char*, char*>& tagMap, const char* moves) {
+        processPGNGame(tagMap, moves);
+    });
+}
+
+void PGNRead::parseDataBlock(char* buffer, long sz, bool connectBlock, const std::function<void(const std::unordered_map<char*, char*>&, const char *)>& gameFunc)
 {
     assert(buffer && sz > 0);
     
@@ -86,7 +293,7 @@ void PGNRead::processDataBlock(char* buffer, long sz, bool connectBlock)
                         if (hasEvent && p - buffer > 2) {
                             *(p - 2) = 0;
                             
-                            processPGNGame(tagMap, moves);
+                            gameFunc(tagMap, moves);
                         }
 
                         tagMap.clear();
@@ -176,7 +383,7 @@ void PGNRead::processDataBlock(char* buffer, long sz, bool connectBlock)
     if (connectBlock) {
         processHalfBegin(event, (long)sz - (event - buffer));
     } else if (moves) {
-        processPGNGame(tagMap, moves);
+        gameFunc(tagMap, moves);
     }
 }
 
@@ -193,6 +400,17 @@ uint64_t PGNRead::processPgnFile(const std::string& path)
 {
     std::cout << "Processing PGN file: '" << path << "'" << std::endl;
 
+    // the file is split at game boundaries by its index, for all threads,
+    // game IDs are the orders of games in the file, the same for all runs
+    if (pgnIndexing) {
+        PgnIndex pgnIndex;
+        if (!pgnIndex.load(path, paraRecord.optionFlag & query_flag_pgn_index)) {
+            std::cerr << "Error: Can't open file: '" << path << "'" << std::endl;
+            return 0;
+        }
+        return processPgnFileByIndex(path, pgnIndex);
+    }
+
 //    auto transactionCnt = 0;
 
     {
@@ -207,7 +425,7 @@ uint64_t PGNRead::processPgnFile(const std::string& path)
         }
         
         blockCnt = processedPgnSz = 0;
-        for (size_t sz = 0, idx = 0; sz < size && gameCnt < paraRecord.gameNumberLimit; idx++) {
+        for (size_t sz = 0, idx = 0; sz < size && gameCnt < paraRecord.gameNumberLimit && !isCancelled(); idx++) {
             auto k = std::min(blockSz, size - sz);
             if (k == 0) {
                 break;
@@ -221,6 +439,7 @@ uint64_t PGNRead::processPgnFile(const std::string& path)
                 processDataBlock(buffer, k, true);
 
                 pool->wait_for_tasks();
+                flushResults();
                 
                 if (idx && (idx & 0xf) == 0) {
                     printStats();
@@ -246,11 +465,92 @@ uint64_t PGNRead::processPgnFile(const std::string& path)
 //        mDb->exec("COMMIT");
 //    }
 
+    pool->wait_for_tasks();
+    flushResults();
     printStats();
 
     return gameCnt;
 }
 
+/// Each thread reads and parses chunks of games by itself, they are taken in order
+/// by an atomic counter thus reading one chunk is the only sequential part
+uint64_t PGNRead::processPgnFileByIndex(const std::string& path, const PgnIndex& pgnIndex)
+{
+    auto size = bslib::Funcs::getFileSize(path);
+    auto& offsets = pgnIndex.offsets;
+    auto chunkCnt = (static_cast<int64_t>(offsets.size()) + pgnIndexChunkGames - 1) / pgnIndexChunkGames;
+
+    for(auto && t : threadMap) {
+        t.second.resetStats();
+    }
+
+    std::atomic<int64_t> nextChunk(0), readSz(0);
+
+    auto readChunks = [&]() {
+        auto t = getThreadRecord(); assert(t);
+
+        std::ifstream file(std::filesystem::u8path(path), std::ios::binary);
+        if (!file) {
+            return;
+        }
+
+        std::vector<char> buffer;
+
+        while (!isCancelled() && succCount < paraRecord.resultNumberLimit) {
+            auto chunkIdx = nextChunk++;
+            if (chunkIdx >= chunkCnt || chunkIdx * pgnIndexChunkGames >= paraRecord.gameNumberLimit) {
+                break;
+            }
+
+            auto first = static_cast<size_t>(chunkIdx * pgnIndexChunkGames);
+            auto last = std::min(first + pgnIndexChunkGames, offsets.size());
+            auto begin = offsets[first];
+            auto end = last < offsets.size() ? offsets[last] : size;
+            if (end <= begin) {
+                continue;
+            }
+
+            auto len = static_cast<size_t>(end - begin);
+            buffer.resize(len + 16);
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(begin));
+            if (!file.read(buffer.data(), static_cast<std::streamsize>(len))) {
+                continue;
+            }
+            buffer[len] = 0;
+            readSz += len;
+
+            // the game ID is the index of the game whose moves are given
+            auto chunkBuf = buffer.data();
+            parseDataBlock(chunkBuf, static_cast<long>(len), false, [&](const std::unordered_map<char*, char*>& tagMap, const char* moves) {
+                auto it = std::upper_bound(offsets.begin() + first, offsets.begin() + last, begin + static_cast<uint64_t>(moves - chunkBuf));
+                t->pgnGameID = static_cast<int>(it - offsets.begin());
+                processPGNGameWithAThread(t, tagMap, moves);
+            });
+            t->pgnGameID = 0;
+        }
+    };
+
+    for(auto i = 0; i < static_cast<int>(pool->get_thread_count()); i++) {
+        pool->push_task(readChunks);
+    }
+    pool->wait_for_tasks();
+    flushResults();
+
+    gameCnt = 0;
+    {
+        std::lock_guard<std::mutex> dolock(threadMapMutex);
+        for(auto && t : threadMap) {
+            gameCnt += t.second.gameCnt;
+        }
+    }
+    blockCnt = chunkCnt;
+    processedPgnSz = readSz;
+
+    printStats();
+    return gameCnt;
+}
+
 
 void doProcessPGNGame(PGNRead* instance, const std::unordered_map<char*, char*>& tagMap, const char* moves)
 {
@@ -15,6 +15,34 @@
 
 namespace ocgdb {
 
+/// Offsets of games in a PGN file, kept in a sidecar file (the PGN path + ".pgni"),
+/// for splitting the file at game boundaries and reading a game by its ID directly
+class PgnIndex
+{
+public:
+    void clear();
+    void scan(const char* buffer, size_t sz, uint64_t blockOffset);
+
+    bool load(const std::string& pgnPath, bool saving);
+    bool build(const std::string& pgnPath);
+    bool read(const std::string& pgnPath);
+    bool write(const std::string& pgnPath) const;
+
+    /// game IDs start from 1
+    bool readGame(const std::string& pgnPath, int gameID, std::string& str) const;
+
+    static std::string indexPath(const std::string& pgnPath);
+
+public:
+    std::vector<uint64_t> offsets;
+
+private:
+    // state of matching a tag Event, which may lie between two blocks
+    char prevCh = '\n';
+    int matchLen = 0;
+    uint64_t matchOffset = 0;
+};
+
 
 class PGNRead : public virtual Core
 {
@@ -32,6 +60,13 @@ private:
     void processHalfBegin(char* buffer, long len);
     void processHalfEnd(char* buffer, long len);
 
+    void parseDataBlock(char* buffer, long sz, bool, const std::function<void(const std::unordered_map<char*, char*>&, const char *)>&);
+    uint64_t processPgnFileByIndex(const std::string& path, const PgnIndex&);
+
+protected:
+    // split PGN files by indexes of games, for all threads and stable game IDs
+    bool pgnIndexing = false;
+
 private:
     const size_t blockSz = 8 * 1024 * 1024;
     const int halfBlockSz = 16 * 1024;
@@ -49,11 +49,18 @@ bool ParaRecord::isValid() const
     }
 
     errorString.clear();
+
+    // only one statement
+    if (where.find(';') != std::string::npos) {
+        errorString = "The SQL predicate of -where must not have any semicolon";
+        return false;
+    }
+
     auto ok = false;
     switch (task) {
         case Task::none:
         {
-            errorString = "Must set a task. Mising or wrong parameter such as -create, -merge, -export, -q, -bench, -g, -dup";
+            errorString = "Must set a task. Mising or wrong parameter such as -create, -merge, -export, -q, -bench, -g, -dup, -perft, -similar, -sancheck";
             break;
         }
         case Task::create:
@@ -124,10 +131,40 @@ bool ParaRecord::isValid() const
             ok = true;
             break;
         }
+        case Task::perft:
+        {
+            if (perftFen.empty() || perftDepth <= 0) {
+                errorString = "Must have a FEN string (or suite) and a depth greater than zero. Mising or wrong parameter -perft";
+                break;
+            }
+
+            ok = true;
+            break;
+        }
+        case Task::similar:
+        {
+            if (dbPaths.empty() || similarFen.empty()) {
+                errorString = "Must have a database (.db3) path and a FEN string. Mising or wrong parameter -db -similar";
+                break;
+            }
+
+            ok = true;
+            break;
+        }
+        case Task::sancheck:
+        {
+            if (!hasPgn) {
+                errorString = "Must have at least one PGN path. Mising or wrong parameter -pgn";
+                break;
+            }
+
+            ok = true;
+            break;
+        }
         case Task::getgame:
         {
-            if (dbPaths.empty() || gameIDVec.empty()) {
-                errorString = "Must have a database (.db3) path and one or some game IDs, each game ID must be greater than zero";
+            if ((dbPaths.empty() && !hasPgn) || gameIDVec.empty()) {
+                errorString = "Must have a database (.db3) or PGN path and one or some game IDs, each game ID must be greater than zero";
                 break;
             }
 
@@ -153,19 +190,32 @@ static const std::map<std::string, int> optionNameMap = {
     {"discardnoelo", 6},
     {"discardfen", 7},
     {"reseteco", 8},
+    {"positions", 9},
 
     // query
     {"printall", 10},
     {"printfen", 11},
     {"printpgn", 12},
 
+    {"similar", 13},
+    {"partition", 14},
+
     {"remove", 15},
     {"embededgames", 16},
+    {"ordered", 17},
+    {"pgnindex", 18},
 
     {"nobot", 20},
     {"bot", 21},
 };
 
+static const std::map<std::string, AggField> aggNameMap = {
+    {"result", AggField::result},
+    {"eco", AggField::eco},
+    {"year", AggField::year},
+    {"nextmove", AggField::nextmove},
+};
+
 std::string ParaRecord::toString(Task task)
 {
     const std::string taskNames[] = {
@@ -176,6 +226,9 @@ std::string ParaRecord::toString(Task task)
         "bench",
         "get game",
         "duplicate",
+        "perft",
+        "similar",
+        "SAN check",
         "none"
     };
         
@@ -208,6 +261,14 @@ std::string ParaRecord::toString() const
         s += "\t\t" + std::to_string(numb) + "\n";
     }
 
+    if (task == Task::perft) {
+        s += "\tPerft: " + perftFen + ", depth: " + std::to_string(perftDepth) + "\n";
+    }
+
+    if (task == Task::similar) {
+        s += "\tSimilar: " + similarFen + "\n";
+    }
+
     s += "\tReport path:\n";
     s += "\t\t" + reportPath + "\n";
 
@@ -230,11 +291,26 @@ std::string ParaRecord::toString() const
     s += "\n";
     s += "\tgameNumberLimit: " + std::to_string(gameNumberLimit) + "\n"
         + "\tresultNumberLimit: " + std::to_string(resultNumberLimit) + "\n"
+        + "\ttimeLimit: " + std::to_string(timeLimit) + "\n"
         + "\tcpu: " + std::to_string(cpuNumber)
         + ", min Elo: " + std::to_string(limitElo)
         + ", min game length: " + std::to_string(limitLen)
         + "\n";
 
+    if (!where.empty()) {
+        s += "\twhere: " + where + "\n";
+    }
+
+    if (aggFlag) {
+        s += "\tAggregates: ";
+        for(auto && it : aggNameMap) {
+            if (hasAggregate(it.second)) {
+                s += it.first + ",";
+            }
+        }
+        s += "\n";
+    }
+
     return s;
 }
 
@@ -259,6 +335,29 @@ void ParaRecord::setupOptions(const std::string& optionString)
     }
 }
 
+void ParaRecord::setupAggregates(const std::string& aggString)
+{
+    auto vec = bslib::Funcs::splitString(aggString, ',');
+
+    for(auto && s : vec) {
+        auto it = aggNameMap.find(s);
+        if (it == aggNameMap.end()) {
+            std::cerr << "Error: Don't know aggregate string: " << s << std::endl;
+        } else {
+            aggFlag |= 1 << static_cast<int>(it->second);
+        }
+    }
+}
+
+void QueryAggregate::merge(const QueryAggregate& other)
+{
+    for(auto i = 0; i < static_cast<int>(AggField::max); i++) {
+        for(auto && it : other.maps[i]) {
+            maps[i][it.first] += it.second;
+        }
+    }
+}
+
 bool ThreadRecord::initForBoards(bslib::ChessVariant variant)
 {
     if (board) return false;
@@ -293,12 +392,16 @@ void ThreadRecord::deleteAllStatements()
 {
     if (insertGameStatement) delete insertGameStatement;
     if (insertCommentStatement) delete insertCommentStatement;
+    if (insertPositionStatement) delete insertPositionStatement;
+    if (insertSimilarStatement) delete insertSimilarStatement;
     if (removeGameStatement) delete removeGameStatement;
     if (getGameStatement) delete getGameStatement;
     if (queryComments) delete queryComments;
     if (qgr) delete qgr;
     insertGameStatement = nullptr;
     insertCommentStatement = nullptr;
+    insertPositionStatement = nullptr;
+    insertSimilarStatement = nullptr;
     removeGameStatement = nullptr;
     getGameStatement = nullptr;
     queryComments = nullptr;
@@ -309,6 +412,7 @@ void ThreadRecord::deleteAllStatements()
 void ThreadRecord::resetStats()
 {
     errCnt = gameCnt = hdpLen = dupCnt = delCnt = 0;
+    resultCacheProbeCnt = resultCacheHitCnt = 0;
 }
 
 
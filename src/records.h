@@ -12,8 +12,12 @@
 #define OCGDB_RECORDS_H
 
 #include <vector>
+#include <deque>
 #include <unordered_map>
+#include <functional>
 #include <fstream>
+#include <thread>
+#include <condition_variable>
 
 #include "3rdparty/SQLiteCpp/SQLiteCpp.h"
 #include "3rdparty/threadpool/thread_pool.hpp"
@@ -44,6 +48,9 @@ enum class Task
     bench,
     getgame,
     dup,
+    perft,
+    similar,
+    sancheck,
     none,
 };
 
@@ -70,11 +77,17 @@ enum {
     create_flag_discard_no_elo          = 1 << 6,
     create_flag_discard_fen             = 1 << 7,
     create_flag_reset_eco               = 1 << 8,
+    create_flag_positions               = 1 << 9,
 
     query_flag_print_all                = 1 << 10,
     query_flag_print_fen                = 1 << 11,
     query_flag_print_pgn                = 1 << 12,
 
+    create_flag_similar                 = 1 << 13,
+    query_flag_partition                = 1 << 14,
+    query_flag_ordered                  = 1 << 17,
+    query_flag_pgn_index                = 1 << 18,
+
     dup_flag_remove                     = 1 << 15,
     dup_flag_embededgames               = 1 << 16,
     
@@ -83,6 +96,13 @@ enum {
 
 };
 
+/// Fields of games matched by queries, counted by -agg
+enum class AggField
+{
+    result, eco, year, nextmove,
+    max
+};
+
 class ParaRecord
 {
 public:
@@ -90,14 +110,22 @@ public:
     std::string reportPath, desc;
 
     std::vector<std::string> queries;
+    std::string where; // an SQL predicate on table Games, for reading databases
     int optionFlag = 0;
+    int aggFlag = 0; // bits of AggField
 
     Task task = Task::none;
     int cpuNumber = -1, limitElo = 0, limitLen = 0;
     std::vector<int> gameIDVec;
+
+    std::string perftFen; // a FEN string or "suite" for the built-in positions
+    int perftDepth = 0;
+
+    std::string similarFen; // find positions similar to this FEN
     
     int64_t gameNumberLimit = 0xffffffffffffULL; // stop when the number of games reached that limit
     int64_t resultNumberLimit = 0xffffffffffffULL; // stop when the number of results reached that limit
+    int64_t timeLimit = 0; // milliseconds, stop working when it is over, 0 for no limit
 
     mutable std::string errorString;
     
@@ -110,6 +138,157 @@ public:
     bool isValid() const;
     
     void setupOptions(const std::string& optionString);
+    void setupAggregates(const std::string& aggString);
+
+    bool hasAggregate(AggField field) const {
+        return aggFlag & (1 << static_cast<int>(field));
+    }
+};
+
+/// Histograms (counts of values) of fields of games matched by a query
+class QueryAggregate
+{
+public:
+    void add(AggField field, const std::string& value) {
+        maps[static_cast<int>(field)][value]++;
+    }
+    void merge(const QueryAggregate& other);
+
+public:
+    std::unordered_map<std::string, int64_t> maps[static_cast<int>(AggField::max)];
+};
+
+/// A hit of a query, kept by the thread found it until its buffer is written
+class SearchHit
+{
+public:
+    int gameID, queryIdx;
+    std::string fen, pgn; // empty if not printed
+};
+
+/// Results of games completed by threads in any order are released in the order
+/// the games were submitted. The reader counts games submitted but not released
+/// yet (size) into its window, thus results waiting here are bounded too
+template <class T>
+class ReorderBuffer
+{
+public:
+    void submit(int gameID) {
+        std::lock_guard<std::mutex> dolock(mutex);
+        orderQueue.push_back(gameID);
+    }
+
+    /// release is called for all results can be released now, one thread at a time
+    void complete(int gameID, T&& result, const std::function<void(T&)>& release) {
+        std::lock_guard<std::mutex> dolock(mutex);
+        doneMap.emplace(gameID, std::move(result));
+
+        while (!orderQueue.empty()) {
+            auto it = doneMap.find(orderQueue.front());
+            if (it == doneMap.end()) {
+                break;
+            }
+            release(it->second);
+            doneMap.erase(it);
+            orderQueue.pop_front();
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> dolock(mutex);
+        orderQueue.clear();
+        doneMap.clear();
+    }
+
+    /// number of games submitted but not released yet
+    int64_t size() const {
+        std::lock_guard<std::mutex> dolock(mutex);
+        return static_cast<int64_t>(orderQueue.size());
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::deque<int> orderQueue;
+    std::unordered_map<int, T> doneMap;
+};
+
+/// The single writer of results: chunks are written by its own thread in the order
+/// they were pushed, thus threads producing them never wait for the output
+template <class T>
+class ChunkWriter
+{
+public:
+    ~ChunkWriter() {
+        stop();
+    }
+
+    void start(const std::function<void(T&)>& _write) {
+        stop();
+        write = _write;
+        stopping = false;
+        thread = std::thread([this]() { run(); });
+    }
+
+    /// write all pushed chunks then end the thread
+    void stop() {
+        if (!thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> dolock(mutex);
+            stopping = true;
+        }
+        queueCv.notify_one();
+        thread.join();
+    }
+
+    void push(T&& chunk) {
+        {
+            std::lock_guard<std::mutex> dolock(mutex);
+            chunkQueue.push_back(std::move(chunk));
+        }
+        queueCv.notify_one();
+    }
+
+    /// wait until all pushed chunks are written
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (thread.joinable()) {
+            doneCv.wait(lock, [this]() { return chunkQueue.empty() && !writing; });
+        }
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for(;;) {
+            queueCv.wait(lock, [this]() { return stopping || !chunkQueue.empty(); });
+            if (chunkQueue.empty()) {
+                break;
+            }
+
+            auto chunk = std::move(chunkQueue.front());
+            chunkQueue.pop_front();
+            writing = true;
+
+            lock.unlock();
+            write(chunk);
+            lock.lock();
+
+            writing = false;
+            if (chunkQueue.empty()) {
+                doneCv.notify_all();
+            }
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable queueCv, doneCv;
+    std::deque<T> chunkQueue;
+    std::function<void(T&)> write;
+    std::thread thread;
+    bool stopping = false, writing = false;
 };
 
 class ThreadRecord
@@ -128,16 +307,38 @@ public:
 public:
     int64_t errCnt = 0, gameCnt = 0, hdpLen = 0, dupCnt = 0, delCnt = 0;
     int insertGameStatementIdxSz = -1;
+    int pgnGameID = 0; // the game ID given by the index of a PGN file, zero if none
+    bool gameCancelled = false; // the current game was stopped partway by cancelling
 
     bslib::BoardCore *board = nullptr, *board2 = nullptr;
     int8_t* buf = nullptr;
     SQLite::Statement *insertGameStatement = nullptr;
     SQLite::Statement *insertCommentStatement = nullptr;
+    SQLite::Statement *insertPositionStatement = nullptr;
+    SQLite::Statement *insertSimilarStatement = nullptr;
     SQLite::Statement *removeGameStatement = nullptr;
     SQLite::Statement *getGameStatement = nullptr;
     SQLite::Statement *queryComments = nullptr;
     
     QueryGameRecord* qgr = nullptr;
+
+    // flags of queries matched by the current game, used by searching
+    std::vector<int8_t> queryHitVec;
+
+    // results of all queries (one bit each) of early positions, keyed by hash keys
+    std::vector<std::pair<uint64_t, uint64_t>> resultCache;
+    int64_t resultCacheProbeCnt = 0, resultCacheHitCnt = 0;
+
+    // later positions of the current game, waiting to be evaluated together
+    bslib::PositionBatch positionBatch;
+
+    // plies of the positions matched by queries of the current game, and
+    // partial histograms of this thread, merged when the search ends
+    std::vector<int> queryHitPlyVec;
+    std::vector<QueryAggregate> queryAggregateVec;
+
+    // hits of queries, not written yet
+    std::vector<SearchHit> hitVec;
 };
 
 
@@ -41,6 +41,11 @@ void Report::printOut(const std::string& str)
 }
 
 void Report::printOutPgn(const bslib::PgnRecord& record)
+{
+    printOut(toPgnString(record));
+}
+
+std::string Report::toPgnString(const bslib::PgnRecord& record)
 {
     std::string str;
     for(auto && it : record.tags) {
@@ -52,7 +57,7 @@ void Report::printOutPgn(const bslib::PgnRecord& record)
             str += s;
         }
     }
-    if (str.empty()) return;
+    if (str.empty()) return str;
     str += "\n";
     
     if (!record.moveString.empty()) {
@@ -60,8 +65,7 @@ void Report::printOutPgn(const bslib::PgnRecord& record)
     } else if (record.moveText && record.moveText[0]) {
         str += record.moveText;
     }
-    
-    printOut(str);
+    return str;
 }
 
 void Report::close()
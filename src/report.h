@@ -31,6 +31,7 @@ public:
     void init(bool print, const std::string& path);
     void printOut(const std::string& str);
     void printOutPgn(const bslib::PgnRecord& record);
+    static std::string toPgnString(const bslib::PgnRecord& record);
 
     void close();
 
@@ -8,16 +8,101 @@
  * or copy at http://opensource.org/licenses/MIT)
  */
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
 #include "search.h"
 
+extern bool debugMode;
+
 using namespace ocgdb;
 
+/// Opening positions repeat in many games, results of queries for positions
+/// up to that ply are cached per thread
+static const int resultCacheMaxPly = 24;
+static const size_t resultCacheSize = 1 << 16; // must be a power of two
+
+/// Maximum number of values printed for each histogram of -agg, except years
+static const size_t aggregatePrintLimit = 20;
+
+/// Number of hits a thread keeps before writing them
+static const size_t hitBufferSize = 256;
+
+
 Search::~Search()
 {
     if (qgr) {
         delete qgr;
         qgr = nullptr;
     }
+    deleteQueries();
+}
+
+void Search::deleteQueries()
+{
+    for(auto && q : queryVec) {
+        delete q;
+    }
+    queryVec.clear();
+}
+
+// Parse all queries before reading any game, thus games are replayed only once
+bool Search::parseQueries()
+{
+    deleteQueries();
+
+    for(auto && _query : paraRecord.queries) {
+        auto query = _query;
+
+        // remove comments by //
+        if (query.find("//") != std::string::npos) {
+            while(true) {
+                auto p = query.find("//");
+                if (p == std::string::npos) {
+                    break;
+                }
+                
+                auto q = p + 2;
+                for(; q < query.size(); q++) {
+                    auto ch = query.at(q);
+                    if (ch == '\n') {
+                        q++;
+                        break;
+                    }
+                }
+                
+                auto s = query.substr(0, p);
+                if (q >= query.size()) {
+                    query = s;
+                    break;
+                } else {
+                    auto s2 = query.substr(q);
+                    query = s + s2;
+                }
+            }
+        }
+        
+        bslib::Funcs::trim(query);
+
+        if (query.empty()) {
+            continue;
+        }
+
+        std::cout << "Search with query " << query <<  "..." << std::endl;
+        
+        auto searchQuery = new SearchQuery;
+        searchQuery->query = query;
+        if (!searchQuery->parser.parse(chessVariant, query.c_str())) {
+            std::cerr << "Error: " << searchQuery->parser.getErrorString() << std::endl;
+            delete searchQuery;
+            continue;
+        }
+
+        queryVec.push_back(searchQuery);
+    }
+
+    return !queryVec.empty();
 }
 
 void Search::runTask()
@@ -40,166 +125,500 @@ void Search::runTask()
     eventCnt = playerCnt = siteCnt = 1;
     errCnt = 0;
     succCount = 0;
+    printCount = 0;
 
-    checkToStop = nullptr;
-    
-    boardCallback = [=](const bslib::BoardCore* board, const bslib::PgnRecord* record) -> bool {
-        assert(board);
-        
-        for(int i = 1, n = board->getHistListSize(); i <= n; i++) {
-            std::vector<uint64_t> bitboardVec;
+    if (!parseQueries()) {
+        return;
+    }
 
-            if (i < n) {
-                auto hist = board->_getHistPointerAt(i);
-                assert(hist && !hist->bitboardVec.empty());
-                bitboardVec = hist->bitboardVec;
-            } else {
-                // last position
-                bitboardVec = board->posToBitboards();
-            }
+    hitWriter.start([this](std::vector<SearchHit>& hitVec) {
+        writeHits(hitVec);
+    });
 
-            if (!parser.evaluate(bitboardVec)) {
-                continue;
+    // PGN files are split by indexes of games for all threads, the indexes
+    // are kept in files for next queries with option pgnindex
+    pgnIndexing = true;
+
+    // Query PGN files
+    for(auto && path : paraRecord.pgnPaths) {
+        startTime = getNow();
+        processPgnFile(path);
+
+        if (cancelled) {
+            auto fileSize = std::max<int64_t>(1, static_cast<int64_t>(bslib::Funcs::getFileSize(path)));
+            std::cout << "Time out! Partial results of " << path << ", #succ: " << succCount
+                      << ", processed games: " << gameCnt
+                      << ", read: " << std::min<int64_t>(100, processedPgnSz * 100 / fileSize) << "% of the file" << std::endl;
+            break;
+        }
+    }
+
+    // Query databases
+    // headers of hits are queried by their IDs, thus only columns for replaying are read
+    if (!paraRecord.dbPaths.empty()) {
+        for(auto && dbPath : paraRecord.dbPaths) {
+            gameCnt = commentCnt = 0;
+            eventCnt = playerCnt = siteCnt = 1;
+            errCnt = 0;
+            if (cancelled) {
+                break;
+            }
+            readADb(dbPath, "");
+
+            if (cancelled) {
+                int64_t doneCnt = 0;
+                {
+                    std::lock_guard<std::mutex> dolock(threadMapMutex);
+                    for(auto && t : threadMap) {
+                        doneCnt += t.second.gameCnt;
+                    }
+                }
+                std::cout << "Time out! Partial results of " << dbPath << ", #succ: " << succCount
+                          << ", processed games: " << doneCnt << " of " << dbGameCnt
+                          << " (" << (dbGameCnt > 0 ? doneCnt * 100 / dbGameCnt : 0) << "%)" << std::endl;
             }
+        }
+    }
 
-            succCount++;
+    hitWriter.stop();
+    printAggregates();
+}
 
-            if (paraRecord.optionFlag & query_flag_print_all) {
-                std::lock_guard<std::mutex> dolock(printMutex);
 
-                std::cout << succCount << ". gameId: " << (record ? record->gameID : -1) << std::endl;
-            }
+// Evaluate all queries position by position while replaying, each query
+// is counted once per game, stop when all queries are hit or can't be matched anymore
+bool Search::checkToStop(ThreadRecord* t, const bslib::PositionBB& bitboards, const bslib::BoardCore* board, const bslib::PgnRecord* record)
+{
+    assert(t && board);
 
-            if (printOut.isOn()) {
-                if (paraRecord.optionFlag & query_flag_print_fen) {
-                    std::string str = std::to_string(succCount) + ". gameId: " + std::to_string(record ? record->gameID : -1) +
-                                ", fen: " + board->getFen() + "\n";
-                    printOut.printOut(str);
-                }
+    if (cancelled) {
+        t->gameCancelled = true;
+        return true;
+    }
 
-                static std::string printOutQuery;
+    // the starting position is not counted
+    auto ply = board->getHistListSize();
+    if (ply == 0) {
+        return false;
+    }
 
-                if (query != printOutQuery) {
-                    printOutQuery = query;
-                    printOut.printOut("; >>>>>> Query: " + query + "\n");
-                }
-                if (qgr) {
-                    printGamePGNByIDs(*qgr, std::vector<int>{record->gameID});
-                } else {
-                    printOut.printOutPgn(*record);
+    // all queries were decided, the game was replayed one more move for the next move of a hit
+    if (paraRecord.hasAggregate(AggField::nextmove)
+        && std::find(t->queryHitVec.begin(), t->queryHitVec.end(), 0) == t->queryHitVec.end()) {
+        return true;
+    }
+
+    // positions after the cached ones are collected and evaluated in batches,
+    // except when printing FENs, which need the board at the matched position
+    if (ply > resultCacheMaxPly && !(paraRecord.optionFlag & query_flag_print_fen)) {
+        t->positionBatch.add(bitboards);
+        return t->positionBatch.isFull() && checkBatch(t, &bitboards, ply, record) && !needsNextMove(t, ply);
+    }
+
+    // bounds of queries change only after captures and pawn moves
+    auto checkingBounds = board->quietCnt == 0 || ply == 1;
+
+    // results of all queries for the position, from the cache or evaluated to store in
+    uint64_t resultBits = 0;
+    auto hasResultBits = false;
+    if (ply <= resultCacheMaxPly && queryVec.size() <= 64) {
+        if (t->resultCache.empty()) {
+            t->resultCache.resize(resultCacheSize);
+        }
+
+        auto hashKey = bitboards[static_cast<int>(bslib::BBIdx::hash)];
+        auto& entry = t->resultCache[hashKey & (resultCacheSize - 1)];
+        t->resultCacheProbeCnt++;
+        if (entry.first == hashKey) {
+            resultBits = entry.second;
+            t->resultCacheHitCnt++;
+        } else {
+            for(size_t i = 0; i < queryVec.size(); i++) {
+                if (queryVec[i]->parser.evaluate(bitboards)) {
+                    resultBits |= 1ULL << i;
                 }
             }
+            entry.first = hashKey;
+            entry.second = resultBits;
+        }
+        hasResultBits = true;
+    }
 
-            return true;
+    auto allDone = true;
+    for(size_t i = 0; i < queryVec.size(); i++) {
+        if (t->queryHitVec[i]) {
+            continue;
         }
 
+        auto searchQuery = queryVec[i];
+        if (checkingBounds && !searchQuery->parser.isPossible(bitboards)) {
+            t->queryHitVec[i] = -1; // impossible from now, stop evaluating it
+            continue;
+        }
+
+        auto hit = hasResultBits ? (resultBits >> i) & 1 : searchQuery->parser.evaluate(bitboards);
+        if (!hit) {
+            allDone = false;
+            continue;
+        }
+
+        t->queryHitVec[i] = 1;
+        t->queryHitPlyVec[i] = ply;
+        succCount++;
+        searchQuery->succCount++;
+        addHit(t, static_cast<int>(i), board, record);
+    }
+
+    return allDone && !needsNextMove(t, ply);
+}
+
+/// The next move of a position matched at the current ply is known after one more move
+bool Search::needsNextMove(const ThreadRecord* t, int ply) const
+{
+    if (!paraRecord.hasAggregate(AggField::nextmove)) {
         return false;
-    };
+    }
 
-    
-    for(auto && _query : paraRecord.queries) {
-        query = _query;
+    for(size_t i = 0; i < queryVec.size(); i++) {
+        if (t->queryHitVec[i] == 1 && t->queryHitPlyVec[i] == ply) {
+            return true;
+        }
+    }
+    return false;
+}
 
-        // remove comments by //
-        if (query.find("//") != std::string::npos) {
-            while(true) {
-                auto p = query.find("//");
-                if (p == std::string::npos) {
-                    break;
-                }
-                
-                auto q = p + 2;
-                for(; q < query.size(); q++) {
-                    auto ch = query.at(q);
-                    if (ch == '\n') {
-                        q++;
-                        break;
-                    }
-                }
-                
-                auto s = query.substr(0, p);
-                if (q >= query.size()) {
-                    query = s;
-                    break;
-                } else {
-                    auto s2 = query.substr(q);
-                    query = s + s2;
-                }
+/// Evaluate all queries for the positions of the batch. Bounds are irreversible,
+/// they are checked with the last position only (nullptr for skipping)
+bool Search::checkBatch(ThreadRecord* t, const bslib::PositionBB* lastBitboards, int lastPly, const bslib::PgnRecord* record)
+{
+    assert(t);
+
+    auto allDone = true;
+    for(size_t i = 0; i < queryVec.size(); i++) {
+        if (t->queryHitVec[i]) {
+            continue;
+        }
+
+        auto searchQuery = queryVec[i];
+        auto k = searchQuery->parser.evaluateBatch(t->positionBatch);
+        if (k < 0) {
+            if (lastBitboards && !searchQuery->parser.isPossible(*lastBitboards)) {
+                t->queryHitVec[i] = -1;
+            } else {
+                allDone = false;
             }
+            continue;
         }
-        
-        bslib::Funcs::trim(query);
 
-        if (query.empty()) {
-            continue;;
+        t->queryHitVec[i] = 1;
+        t->queryHitPlyVec[i] = lastPly - (t->positionBatch.size - 1 - k);
+        succCount++;
+        searchQuery->succCount++;
+        addHit(t, static_cast<int>(i), nullptr, record);
+    }
+
+    t->positionBatch.clear();
+    return allDone;
+}
+
+/// Hits are kept by their threads and handed in chunks to the writer, printing (and
+/// querying PGNs of hits) is done by the writer thread only, it does not stop other threads
+void Search::addHit(ThreadRecord* t, int queryIdx, const bslib::BoardCore* board, const bslib::PgnRecord* record)
+{
+    assert(t && record);
+    if (!(paraRecord.optionFlag & query_flag_print_all) && !printOut.isOn()) {
+        return;
+    }
+
+    SearchHit hit;
+    hit.gameID = record->gameID;
+    hit.queryIdx = queryIdx;
+
+    if (printOut.isOn()) {
+        if ((paraRecord.optionFlag & query_flag_print_fen) && board) {
+            hit.fen = board->getFen();
+        }
+        // games of PGN files can't be queried later by their IDs
+        if (!qgr) {
+            hit.pgn = Report::toPgnString(*record);
         }
+    }
 
-        std::cout << "Search with query " << query <<  "..." << std::endl;
-        
-        assert(paraRecord.task != Task::create);
-        if (!parser.parse(chessVariant, query.c_str())) {
-            std::cerr << "Error: " << parser.getErrorString() << std::endl;
-            continue;;
-        }
-
-        // Query PGN files
-        for(auto && path : paraRecord.pgnPaths) {
-            startTime = getNow();
-            processPgnFile(path);
-        }
-
-        // Query databases
-        if (!paraRecord.dbPaths.empty()) {
-            auto queryString = (paraRecord.optionFlag & query_flag_print_pgn) ? DbRead::fullGameQueryString : "SELECT * FROM Games";
-            for(auto && dbPath : paraRecord.dbPaths) {
-                gameCnt = commentCnt = 0;
-                eventCnt = playerCnt = siteCnt = 1;
-                errCnt = 0;
-                readADb(dbPath, queryString);
+    t->hitVec.push_back(hit);
+    if (t->hitVec.size() >= hitBufferSize && !(paraRecord.optionFlag & query_flag_ordered)) {
+        flushHits(t);
+    }
+}
+
+void Search::flushHits(ThreadRecord* t)
+{
+    assert(t);
+    if (!t->hitVec.empty()) {
+        hitWriter.push(std::move(t->hitVec));
+        t->hitVec.clear();
+    }
+}
+
+void Search::writeHits(const std::vector<SearchHit>& hitVec)
+{
+    std::lock_guard<std::mutex> dolock(printMutex);
+
+    for(auto && hit : hitVec) {
+        auto searchQuery = queryVec[hit.queryIdx];
+        printCount++;
+
+        if (paraRecord.optionFlag & query_flag_print_all) {
+            std::cout << printCount << ". gameId: " << hit.gameID;
+            if (queryVec.size() > 1) {
+                std::cout << ", query: " << searchQuery->query;
+            }
+            std::cout << std::endl;
+        }
+
+        if (printOut.isOn()) {
+            if (!hit.fen.empty()) {
+                std::string str = std::to_string(printCount) + ". gameId: " + std::to_string(hit.gameID) +
+                            ", fen: " + hit.fen + "\n";
+                printOut.printOut(str);
+            }
+
+            if (searchQuery->query != printOutQuery) {
+                printOutQuery = searchQuery->query;
+                printOut.printOut("; >>>>>> Query: " + printOutQuery + "\n");
+            }
+            if (qgr) {
+                printGamePGNByIDs(*qgr, std::vector<int>{hit.gameID});
+            } else {
+                printOut.printOut(hit.pgn);
             }
         }
     }
 }
 
+void Search::flushResults()
+{
+    {
+        std::lock_guard<std::mutex> dolock(threadMapMutex);
+        for(auto && t : threadMap) {
+            flushHits(&t.second);
+        }
+    }
+    hitWriter.drain();
+}
 
 void Search::processAGameWithAThread(ThreadRecord* t, const bslib::PgnRecord& record, const std::vector<int8_t>& moveVec)
 {
     assert(t);
 
+    // pending games are dropped once the search is cancelled or has enough results
+    if (isCancelled() || succCount >= paraRecord.resultNumberLimit) {
+        completeGame(t, record.gameID);
+        return;
+    }
+
     if (!t->board) {
         t->board = bslib::Funcs::createBoard(bslib::ChessVariant::standard);
     }
     assert(t->board);
     
-    t->board->newGame(record.fenText);
+    t->board->_newGame(record.fenText);
     
-    int flag = bslib::BoardCore::ParseMoveListFlag_create_bitboard;
+    t->queryHitVec.assign(queryVec.size(), 0);
+    t->queryHitPlyVec.assign(queryVec.size(), 0);
+    t->positionBatch.clear();
+    t->gameCancelled = false;
+
+    // the board is owned by this thread, replay it without locking
+    auto stopFunc = [this, t](const bslib::PositionBB& bitboards, const bslib::BoardCore* board, const bslib::PgnRecord* record) {
+        return checkToStop(t, bitboards, board, record);
+    };
+
+    int flag = bslib::BoardCore::ParseMoveListFlag_create_bitboard
+                | bslib::BoardCore::ParseMoveListFlag_compact_hist;
     if (searchField == SearchField::moves) { // there is a text move only
-        flag |= bslib::BoardCore::ParseMoveListFlag_quick_check;
-        t->board->fromMoveList(&record, bslib::Notation::san, flag, checkToStop);
+        flag |= bslib::BoardCore::ParseMoveListFlag_quick_check
+                | bslib::BoardCore::ParseMoveListFlag_discardComment;
+        t->board->_fromMoveList(&record, bslib::Notation::san, flag, stopFunc);
     } else {
         if (searchField == SearchField::moves1) {
             flag |= bslib::BoardCore::ParseMoveListFlag_move_size_1_byte;
         }
-        
-        if (paraRecord.optionFlag & query_flag_print_pgn) {
-            flag |= bslib::BoardCore::ParseMoveListFlag_create_san;
-        }
-        t->board->fromMoveList(&record, moveVec, flag, checkToStop);
+        t->board->_fromMoveList(&record, moveVec, flag, stopFunc);
     }
 
-    t->hdpLen += t->board->getHistListSize();
+    // a game stopped partway is not counted, nor its last positions and statistics
+    if (t->gameCancelled) {
+        completeGame(t, record.gameID);
+        return;
+    }
 
-    if (boardCallback) {
-        boardCallback(t->board, &record);
+    // the last positions of the game
+    if (!t->positionBatch.empty()) {
+        checkBatch(t, nullptr, t->board->getHistListSize(), &record);
     }
+    aggregate(t, record);
+
+    t->hdpLen += t->board->getHistListSize();
+
     t->gameCnt++;
+
+    completeGame(t, record.gameID);
+}
+
+void Search::completeGame(ThreadRecord* t, int gameID)
+{
+    // hits are written in the order of reading games
+    if (paraRecord.optionFlag & query_flag_ordered) {
+        hitOrder.complete(gameID, std::move(t->hitVec), [this](std::vector<SearchHit>& hitVec) {
+            if (!hitVec.empty()) {
+                hitWriter.push(std::move(hitVec));
+            }
+        });
+        t->hitVec.clear();
+    }
+}
+
+void Search::submittingAGame(int gameID)
+{
+    if (paraRecord.optionFlag & query_flag_ordered) {
+        hitOrder.submit(gameID);
+    }
+}
+
+int64_t Search::pendingGameCount() const
+{
+    // games waiting for a slow game before them to write hits are in the window too
+    if (paraRecord.optionFlag & query_flag_ordered) {
+        return hitOrder.size();
+    }
+    return DbRead::pendingGameCount();
+}
+
+/// Count the game into partial histograms of this thread, for the queries it matched
+void Search::aggregate(ThreadRecord* t, const bslib::PgnRecord& record)
+{
+    if (!paraRecord.aggFlag) {
+        return;
+    }
+
+    if (t->queryAggregateVec.size() < queryVec.size()) {
+        t->queryAggregateVec.resize(queryVec.size());
+    }
+
+    auto getTag = [&record](const std::string& name) {
+        auto it = record.tags.find(name);
+        return it == record.tags.end() || it->second.empty() ? std::string("?") : it->second;
+    };
+
+    for(size_t i = 0; i < queryVec.size(); i++) {
+        if (t->queryHitVec[i] != 1) {
+            continue;
+        }
+
+        auto& agg = t->queryAggregateVec[i];
+        if (paraRecord.hasAggregate(AggField::result)) {
+            agg.add(AggField::result, getTag("Result"));
+        }
+        if (paraRecord.hasAggregate(AggField::eco)) {
+            agg.add(AggField::eco, getTag("ECO"));
+        }
+        if (paraRecord.hasAggregate(AggField::year)) {
+            auto date = getTag("Date");
+            auto year = date.substr(0, 4);
+            agg.add(AggField::year, year.size() == 4 && std::isdigit(year[0]) ? year : "?");
+        }
+        if (paraRecord.hasAggregate(AggField::nextmove)) {
+            auto ply = t->queryHitPlyVec[i];
+            agg.add(AggField::nextmove, ply < t->board->getHistListSize() ? t->board->toString(t->board->_getMoveAt(ply)) : "(end)");
+        }
+    }
+}
+
+/// Merge histograms of all threads and print them, years in order,
+/// other fields from the most frequent values
+void Search::printAggregates()
+{
+    if (!paraRecord.aggFlag || queryVec.empty()) {
+        return;
+    }
+
+    if (pool) {
+        pool->wait_for_tasks();
+    }
+
+    std::vector<QueryAggregate> aggVec(queryVec.size());
+    {
+        std::lock_guard<std::mutex> dolock(threadMapMutex);
+        for(auto && t : threadMap) {
+            for(size_t i = 0; i < t.second.queryAggregateVec.size() && i < aggVec.size(); i++) {
+                aggVec[i].merge(t.second.queryAggregateVec[i]);
+            }
+        }
+    }
+
+    const std::string fieldNames[] = { "result", "eco", "year", "nextmove" };
+
+    for(size_t i = 0; i < queryVec.size(); i++) {
+        std::cout << "\nAggregates of query: " << queryVec[i]->query
+                  << ", #games: " << queryVec[i]->succCount << std::endl;
+
+        for(auto f = 0; f < static_cast<int>(AggField::max); f++) {
+            auto field = static_cast<AggField>(f);
+            if (!paraRecord.hasAggregate(field)) {
+                continue;
+            }
+
+            std::vector<std::pair<std::string, int64_t>> vec(aggVec[i].maps[f].begin(), aggVec[i].maps[f].end());
+            int64_t total = 0;
+            for(auto && p : vec) {
+                total += p.second;
+            }
+
+            if (field == AggField::year) {
+                std::sort(vec.begin(), vec.end());
+            } else {
+                std::sort(vec.begin(), vec.end(), [](const std::pair<std::string, int64_t>& a, const std::pair<std::string, int64_t>& b) {
+                    return a.second > b.second || (a.second == b.second && a.first < b.first);
+                });
+                if (vec.size() > aggregatePrintLimit) {
+                    vec.resize(aggregatePrintLimit);
+                }
+            }
+
+            std::cout << "  " << fieldNames[f] << ":" << std::endl;
+            for(auto && p : vec) {
+                std::cout << "    " << p.first << ": " << p.second
+                          << " (" << (total ? p.second * 100 / total : 0) << "%)" << std::endl;
+            }
+        }
+    }
 }
 
 void Search::printStats() const
 {
-    DbCore::printStats();
-    std::cout << " #succ: " << succCount << std::endl;
+    DbRead::printStats();
+    std::cout << " #succ: " << succCount;
+
+    int64_t probeCnt = 0, hitCnt = 0;
+    {
+        std::lock_guard<std::mutex> dolock(threadMapMutex);
+        for(auto && t : threadMap) {
+            probeCnt += t.second.resultCacheProbeCnt;
+            hitCnt += t.second.resultCacheHitCnt;
+        }
+    }
+    if (probeCnt > 0) {
+        std::cout << ", cache hits: " << hitCnt * 100 / probeCnt << "%";
+    }
+    std::cout << std::endl;
+
+    if (queryVec.size() > 1) {
+        std::lock_guard<std::mutex> dolock(printMutex);
+        for(size_t i = 0; i < queryVec.size(); i++) {
+            std::cout << "  " << (i + 1) << ". #succ: " << queryVec[i]->succCount
+                      << ", query: " << queryVec[i]->query << std::endl;
+        }
+    }
 
 }
 
@@ -207,17 +626,19 @@ void Search::processPGNGameWithAThread(ThreadRecord* t, const std::unordered_map
 {
     assert(t);
 
+    if (isCancelled() || succCount >= paraRecord.resultNumberLimit) {
+        return;
+    }
+
     if (!t->board) {
         t->board = bslib::Funcs::createBoard(bslib::ChessVariant::standard);
     }
     assert(t->board);
     
+    // given by the index of the PGN file, no need to count games together
+    assert(t->pgnGameID > 0);
     bslib::PgnRecord record;
-    {
-        std::lock_guard<std::mutex> dolock(gameIDMutex);
-        ++gameCnt;
-        record.gameID = gameCnt;
-    }
+    record.gameID = t->pgnGameID;
 
     record.moveText = moveText;
     
@@ -230,21 +651,36 @@ void Search::processPGNGameWithAThread(ThreadRecord* t, const std::unordered_map
     }
 
     // Parse moves
-    t->board->newGame(record.fenText);
+    t->board->_newGame(record.fenText);
+
+    t->queryHitVec.assign(queryVec.size(), 0);
+    t->queryHitPlyVec.assign(queryVec.size(), 0);
+    t->positionBatch.clear();
+    t->gameCancelled = false;
+
+    // the board is owned by this thread, replay it without locking
+    auto stopFunc = [this, t](const bslib::PositionBB& bitboards, const bslib::BoardCore* board, const bslib::PgnRecord* record) {
+        return checkToStop(t, bitboards, board, record);
+    };
 
     int flag = bslib::BoardCore::ParseMoveListFlag_quick_check
                 | bslib::BoardCore::ParseMoveListFlag_discardComment
-                | bslib::BoardCore::ParseMoveListFlag_create_bitboard;
+                | bslib::BoardCore::ParseMoveListFlag_create_bitboard
+                | bslib::BoardCore::ParseMoveListFlag_compact_hist;
+
+    t->board->_fromMoveList(&record, bslib::Notation::san, flag, stopFunc);
 
-    if (paraRecord.optionFlag & query_flag_print_pgn) {
-        flag |= bslib::BoardCore::ParseMoveListFlag_create_san;
+    // a game stopped partway is not counted, nor its last positions and statistics
+    if (t->gameCancelled) {
+        return;
     }
-    t->board->fromMoveList(&record, bslib::Notation::san, flag, checkToStop);
-    
-    if (boardCallback) {
-        boardCallback(t->board, &record);
+
+    if (!t->positionBatch.empty()) {
+        checkBatch(t, nullptr, t->board->getHistListSize(), &record);
     }
+    aggregate(t, record);
 
+    t->gameCnt++;
 }
 
 bool Search::openDB(const std::string& dbPath)
@@ -257,6 +693,66 @@ bool Search::openDB(const std::string& dbPath)
         startTime = getNow();
         
         qgr = new QueryGameRecord(*mDb, searchField);
+        hitOrder.clear();
+
+        // for the part of the database covered when the search is cancelled
+        dbGameCnt = 0;
+        if (mDb->tableExists("Info")) {
+            SQLite::Statement statement(*mDb, "SELECT Value FROM Info WHERE Name = 'GameCount'");
+            if (statement.executeStep()) {
+                dbGameCnt = std::atoll(statement.getColumn(0).getText());
+            }
+        }
+
+        // fields of games counted by -agg, if the database has them
+        extraColumns.clear();
+        const std::pair<AggField, std::string> aggColumns[] = {
+            {AggField::result, "Result"}, {AggField::eco, "ECO"}, {AggField::year, "Date"}
+        };
+        for(auto && p : aggColumns) {
+            if (paraRecord.hasAggregate(p.first) && DbRead::hasField(mDb, p.second)) {
+                extraColumns.push_back(p.second);
+            }
+        }
+
+        sqlWhere.clear();
+
+        // find games of FENs by the index of positions, only those games are replayed
+        if (mDb->tableExists("Positions")) {
+            std::set<uint64_t> hashSet;
+            auto fenOnly = true;
+            for(auto && searchQuery : queryVec) {
+                if (!searchQuery->parser.getFenHashSet(hashSet)) {
+                    fenOnly = false;
+                    break;
+                }
+            }
+
+            if (fenOnly && !hashSet.empty()) {
+                std::string str;
+                for(auto && hashKey : hashSet) {
+                    str += (str.empty() ? "" : ", ") + std::to_string(static_cast<int64_t>(hashKey));
+                }
+                sqlWhere = "g.ID IN (SELECT GameID FROM Positions WHERE Hash IN (" + str + "))";
+                std::cout << "Using table Positions" << std::endl;
+                return true;
+            }
+        }
+
+        // skip games whose material never reaches what all queries need
+        if (DbRead::hasField(mDb, "Material")) {
+            for(auto && searchQuery : queryVec) {
+                auto s = searchQuery->parser.materialFilter("Material");
+                if (s.empty()) {
+                    sqlWhere.clear();
+                    break;
+                }
+                sqlWhere += (sqlWhere.empty() ? "" : " OR ") + s;
+            }
+            if (debugMode && !sqlWhere.empty()) {
+                std::cout << "Material filter: " << sqlWhere << std::endl;
+            }
+        }
         return true;
     }
     return false;
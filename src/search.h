@@ -17,6 +17,16 @@
 
 namespace ocgdb {
 
+/// A parsed query with its own results, all queries are evaluated
+/// in the same pass of games
+class SearchQuery
+{
+public:
+    std::string query;
+    Parser parser;
+    std::atomic<int64_t> succCount { 0 };
+};
+
 
 class Search : public DbRead, public PGNRead
 {
@@ -37,11 +47,30 @@ private:
     virtual void runTask() override;
     virtual void printStats() const override;
 
+    bool parseQueries();
+    void deleteQueries();
+
+    bool checkToStop(ThreadRecord*, const bslib::PositionBB&, const bslib::BoardCore*, const bslib::PgnRecord*);
+    bool checkBatch(ThreadRecord*, const bslib::PositionBB*, int lastPly, const bslib::PgnRecord*);
+    bool needsNextMove(const ThreadRecord*, int ply) const;
+    void addHit(ThreadRecord*, int queryIdx, const bslib::BoardCore*, const bslib::PgnRecord*);
+    void flushHits(ThreadRecord*);
+    void writeHits(const std::vector<SearchHit>&);
+    void completeGame(ThreadRecord*, int gameID);
+    virtual void submittingAGame(int gameID) override;
+    virtual int64_t pendingGameCount() const override;
+    virtual void flushResults() override;
+
+    void aggregate(ThreadRecord*, const bslib::PgnRecord&);
+    void printAggregates();
+
 private:
-    mutable std::mutex gameIDMutex;
-    std::string query;
-    
-    Parser parser;
+    std::vector<SearchQuery*> queryVec;
+    std::string printOutQuery;
+    int64_t printCount = 0; // hits written, by the writer thread only
+    ReorderBuffer<std::vector<SearchHit>> hitOrder;
+    ChunkWriter<std::vector<SearchHit>> hitWriter;
+    int64_t dbGameCnt = 0;
     QueryGameRecord* qgr = nullptr;
 
 };
@@ -0,0 +1,228 @@
+/**
+ * This file is part of Open Chess Game Database Standard.
+ *
+ * Copyright (c) 2021-2022 Nguyen Pham (github@nguyenpham)
+ * Copyright (c) 2021-2022 Developers
+ *
+ * Distributed under the MIT License (MIT) (See accompanying file LICENSE.txt
+ * or copy at http://opensource.org/licenses/MIT)
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <set>
+#include <cstring>
+
+#include "similar.h"
+
+using namespace ocgdb;
+using bslib::popCount;
+using bslib::bitScan;
+
+/// Number of positions printed when -resultcount is not set
+static const int64_t defaultTopCount = 100;
+
+/// Positions sharing a band with the query are read up to this limit, per band
+static const int candidateLimitPerBand = 20000;
+
+
+// the finalizer of SplitMix64
+static inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+void SimilarIndex::getPieceBoards(const bslib::PositionBB& bitboards, uint64_t* pieceBoards)
+{
+    for(auto i = 0; i < PieceBoardCount; i++) {
+        pieceBoards[i] = bitboards[static_cast<int>(bslib::BBIdx::black) + i];
+    }
+}
+
+/// Number of squares whose pieces (side and type) are different
+int SimilarIndex::distance(const uint64_t* pieceBoards0, const uint64_t* pieceBoards1)
+{
+    auto d = 0;
+    for(auto sd = 0; sd < 2; sd++) {
+        for(auto t = 2; t < PieceBoardCount; t++) {
+            d += popCount((pieceBoards0[sd] & pieceBoards0[t]) ^ (pieceBoards1[sd] & pieceBoards1[t]));
+        }
+    }
+    return d;
+}
+
+/// Each piece on a square is a feature. The hash functions of MinHash are
+/// h1 + i * h2 of the feature, the values of a band are hashed into its key
+void SimilarIndex::computeBands(const bslib::PositionBB& bitboards, int64_t* bands)
+{
+    const int hashCount = BandCount * RowCount;
+    uint64_t minValues[hashCount];
+    std::fill(minValues, minValues + hashCount, ~0ULL);
+
+    uint64_t pieceBoards[PieceBoardCount];
+    getPieceBoards(bitboards, pieceBoards);
+
+    for(auto sd = 0; sd < 2; sd++) {
+        for(auto t = 2; t < PieceBoardCount; t++) {
+            for(auto b = pieceBoards[sd] & pieceBoards[t]; b; b &= b - 1) {
+                uint64_t feature = static_cast<uint64_t>((sd * 6 + t - 2) * 64 + bitScan(b));
+                auto h1 = mix64(feature + 1), h2 = mix64(h1) | 1;
+                for(auto i = 0; i < hashCount; i++) {
+                    minValues[i] = std::min(minValues[i], h1 + i * h2);
+                }
+            }
+        }
+    }
+
+    for(auto i = 0; i < BandCount; i++) {
+        uint64_t key = static_cast<uint64_t>(i);
+        for(auto r = 0; r < RowCount; r++) {
+            key = mix64(key ^ minValues[i * RowCount + r]);
+        }
+        bands[i] = static_cast<int64_t>(key);
+    }
+}
+
+std::string SimilarIndex::createTableString()
+{
+    std::string str = "CREATE TABLE SimilarPositions (GameID INTEGER, Ply INTEGER, Pieces BLOB";
+    for(auto i = 0; i < BandCount; i++) {
+        str += ", Band" + std::to_string(i) + " INTEGER";
+    }
+    return str + ")";
+}
+
+std::string SimilarIndex::insertString()
+{
+    std::string str = "INSERT INTO SimilarPositions (GameID, Ply, Pieces", values = "?, ?, ?";
+    for(auto i = 0; i < BandCount; i++) {
+        str += ", Band" + std::to_string(i);
+        values += ", ?";
+    }
+    return str + ") VALUES (" + values + ")";
+}
+
+
+Similar::~Similar()
+{
+    if (board) {
+        delete board;
+        board = nullptr;
+    }
+}
+
+void Similar::runTask()
+{
+    std::cout << "Finding similar positions..." << std::endl;
+
+    board = bslib::Funcs::createBoard(chessVariant);
+    board->newGame(paraRecord.similarFen);
+    if (!board->isValid()) {
+        std::cerr << "Error: invalid FEN: " << paraRecord.similarFen << std::endl;
+        return;
+    }
+
+    for(auto && dbPath : paraRecord.dbPaths) {
+        searchADb(dbPath);
+    }
+}
+
+void Similar::searchADb(const std::string& dbPath)
+{
+    startTime = getNow();
+
+    SQLite::Database db(dbPath, SQLite::OPEN_READONLY);
+    if (!db.tableExists("SimilarPositions")) {
+        std::cerr << "Error: there is no table SimilarPositions (created with option similar) in " << dbPath << std::endl;
+        return;
+    }
+
+    bslib::PositionBB bitboards;
+    board->posToBitboards(bitboards);
+
+    int64_t bands[SimilarIndex::BandCount];
+    SimilarIndex::computeBands(bitboards, bands);
+
+    uint64_t pieceBoards[SimilarIndex::PieceBoardCount];
+    SimilarIndex::getPieceBoards(bitboards, pieceBoards);
+
+    // candidates of all bands, each one once
+    std::set<std::pair<int, int>> candidateSet;
+    std::vector<std::tuple<int, int, int>> resultVec; // distance, game ID, ply
+
+    for(auto i = 0; i < SimilarIndex::BandCount; i++) {
+        SQLite::Statement statement(db, "SELECT GameID, Ply, Pieces FROM SimilarPositions WHERE Band" + std::to_string(i)
+                                    + " = ? LIMIT " + std::to_string(candidateLimitPerBand));
+        statement.bind(1, static_cast<long long>(bands[i]));
+
+        while (statement.executeStep()) {
+            auto gameID = statement.getColumn(0).getInt();
+            auto ply = statement.getColumn(1).getInt();
+            if (!candidateSet.insert(std::make_pair(gameID, ply)).second) {
+                continue;
+            }
+
+            auto c = statement.getColumn(2);
+            uint64_t pieceBoards1[SimilarIndex::PieceBoardCount];
+            if (c.size() != static_cast<int>(sizeof(pieceBoards1))) {
+                continue;
+            }
+            memcpy(pieceBoards1, c.getBlob(), sizeof(pieceBoards1));
+
+            resultVec.push_back(std::make_tuple(SimilarIndex::distance(pieceBoards, pieceBoards1), gameID, ply));
+        }
+    }
+
+    auto topCount = paraRecord.resultNumberLimit < ParaRecord().resultNumberLimit ? paraRecord.resultNumberLimit : defaultTopCount;
+    std::sort(resultVec.begin(), resultVec.end());
+    if (static_cast<int64_t>(resultVec.size()) > topCount) {
+        resultVec.resize(static_cast<size_t>(topCount));
+    }
+
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(getNow() - startTime).count();
+    std::cout << "Similar positions of " << paraRecord.similarFen << ", database: " << dbPath
+              << ", #candidates: " << candidateSet.size() << ", elapsed: " << elapsed << "ms" << std::endl;
+
+    auto searchField = DbRead::getMoveField(&db);
+    QueryGameRecord* qgr = nullptr;
+    if ((paraRecord.optionFlag & query_flag_print_fen) && searchField != SearchField::none) {
+        qgr = new QueryGameRecord(db, searchField);
+    }
+
+    std::vector<int> gameIDVec;
+    auto cnt = 0;
+    for(auto && r : resultVec) {
+        auto gameID = std::get<1>(r), ply = std::get<2>(r);
+        std::cout << ++cnt << ". gameId: " << gameID << ", ply: " << ply << ", distance: " << std::get<0>(r);
+
+        // replay the game then take back to the ply
+        if (qgr) {
+            bslib::PgnRecord record;
+            record.gameID = gameID;
+            qgr->queryGameByID->reset();
+            qgr->queryGameByID->bind(1, gameID);
+            if (qgr->queryGameByID->executeStep()) {
+                DbRead::queryForABoard(record, searchField, qgr->queryGameByID, qgr->queryComments, qgr->board);
+                while (qgr->board->getHistListSize() > ply) {
+                    qgr->board->_takeBack();
+                }
+                std::cout << ", fen: " << qgr->board->getFen();
+            }
+        }
+        std::cout << std::endl;
+        gameIDVec.push_back(gameID);
+    }
+
+    if (qgr) {
+        delete qgr;
+    }
+
+    if ((paraRecord.optionFlag & query_flag_print_pgn) && !gameIDVec.empty()) {
+        printGamePGNByIDs(db, gameIDVec, searchField);
+    }
+}
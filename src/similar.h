@@ -0,0 +1,56 @@
+/**
+ * This file is part of Open Chess Game Database Standard.
+ *
+ * Copyright (c) 2021-2022 Nguyen Pham (github@nguyenpham)
+ * Copyright (c) 2021-2022 Developers
+ *
+ * Distributed under the MIT License (MIT) (See accompanying file LICENSE.txt
+ * or copy at http://opensource.org/licenses/MIT)
+ */
+
+#ifndef OCGDB_SIMILAR_H
+#define OCGDB_SIMILAR_H
+
+#include "dbread.h"
+
+namespace ocgdb {
+
+/// Locality-sensitive hashing of positions. A position is a set of pieces on squares,
+/// its MinHash values are grouped into bands, positions sharing any band with the
+/// query are candidates, they are measured then by Hamming distance of piece bitboards.
+/// A row is a blob of piece bitboards (64 bytes) and the bands, each one indexed, thus
+/// the table takes about 300 bytes per position
+class SimilarIndex
+{
+public:
+    static const int BandCount = 8;
+    static const int RowCount = 3;          // MinHash values of a band
+    static const int PieceBoardCount = 8;   // black, white, kings, queens, rooks, bishops, knights, pawns
+
+    static void computeBands(const bslib::PositionBB& bitboards, int64_t* bands);
+    static void getPieceBoards(const bslib::PositionBB& bitboards, uint64_t* pieceBoards);
+    static int distance(const uint64_t* pieceBoards0, const uint64_t* pieceBoards1);
+
+    static std::string createTableString();
+    static std::string insertString();
+};
+
+
+/// Find positions nearest to a given FEN by the table SimilarPositions, without replaying games
+class Similar : public DbRead
+{
+public:
+    virtual ~Similar();
+
+private:
+    virtual void runTask() override;
+
+    void searchADb(const std::string& dbPath);
+
+private:
+    bslib::BoardCore* board = nullptr;
+};
+
+} // namespace ocdb
+
+#endif /* OCGDB_SIMILAR_H */